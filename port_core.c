@@ -0,0 +1,5230 @@
+#define _GNU_SOURCE
+
+// Simulation engine library: grid, docking search, crews, statistics, the
+// event-driven engine and its outputs. No terminal code; the ncurses front end
+// lives in port_simulation.c.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+
+#include "port_core.h"
+#include "port_sim.h"
+
+Arena arena;
+
+// Port and queue data
+int port_rows = PORT_ROWS;           // Number of rows in the port
+int port_cols = PORT_COLS;           // Number of columns in the port
+PortSlot* port;                      // Slots of the populated tiles, TILE_CELLS per tile in port_tiles order
+int port_dockable = 100;             // Percent of layout tiles with berths
+Yacht* queue;                        // Waiting queue
+Yacht* docked;                       // List of docked yachts
+Yacht* yacht_free_list;              // Recycled yachts of the registry
+
+// Shared hot state. Each item below is written by a different thread or under a
+// different mutex, so each starts its own cache line:
+//   crews[i]                 one line per crew (state and yacht_id change together)
+//   queue_size, docked_size  one line each, written under queue_mutex / docked_mutex
+//   the four mutexes         one line each, so contending on one does not slow the others
+//   stats                    48 bytes on one line, written under stats_mutex
+// The read-mostly pointers and sizes above may share lines.
+PortCrew crews[CREW_CAPACITY];                           // Port crews
+int crew_count = MAX_CREWS;                              // Crews in service
+_Alignas(CACHE_LINE) int queue_size = 0;                 // Current size of the queue
+_Alignas(CACHE_LINE) int docked_size = 0;                // Current size of the docked list
+
+// Mutexes for thread safety
+_Alignas(CACHE_LINE) pthread_mutex_t port_mutex = PTHREAD_MUTEX_INITIALIZER;
+_Alignas(CACHE_LINE) pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+_Alignas(CACHE_LINE) pthread_mutex_t docked_mutex = PTHREAD_MUTEX_INITIALIZER;
+_Alignas(CACHE_LINE) pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Statistics of the run
+PortStats stats = {0};
+
+OutputPipeline output;
+OutStream* trace_out = NULL;      // Event trace (--trace)
+OutStream* metrics_out = NULL;    // Time-series samples (--metrics)
+static TraceIndexer trace_index;  // Index of the event trace, written to trace_index_path
+static char* trace_index_path;
+
+Engine engine;
+
+static void engine_fire(int type, void* arg, int data);
+static void engine_try_dock(Yacht* yacht);
+static void engine_flush_batch();
+static void engine_reset_failures();
+
+// Copy the current waiting time of a yacht into its queue[] entry for display
+void update_queue_wait(Yacht* yacht) {
+    pthread_mutex_lock(&queue_mutex);
+    for (int i = 0; i < queue_size; i++) {
+        if (queue[i].id == yacht->id) {
+            queue[i].waiting_time = yacht->waiting_time;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// Copy the current oil level of a yacht into its docked[] entry for display
+void update_docked_oil(Yacht* yacht) {
+    pthread_mutex_lock(&docked_mutex);
+    for (int i = 0; i < docked_size; i++) {
+        if (docked[i].id == yacht->id) {
+            docked[i].oil_level = atomic_load(&yacht->oil_level);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&docked_mutex);
+}
+
+// Update statistics after a yacht leaves the port
+void record_departure(Yacht* yacht) {
+    pthread_mutex_lock(&stats_mutex);
+    stats.total_yachts_serviced++;
+    stats.total_waiting_time += yacht->waiting_time;
+    if (yacht->waiting_time > stats.max_waiting_time)
+        stats.max_waiting_time = yacht->waiting_time;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+// Add a yacht to the waiting queue
+void add_to_queue(Yacht* yacht) {
+    if (queue_size < MAX_QUEUE) {
+        queue[queue_size++] = *yacht;
+    }
+}
+
+// Index of slot (r, c) in port, -1 if it is open water
+static inline long slot_index(int r, int c) {
+    int t = port_tile_dir[(r >> TILE_BITS) * port_tile_cols + (c >> TILE_BITS)];
+    return t < 0 ? -1 : (long)t * TILE_CELLS + ((r & (TILE_SIZE - 1)) << TILE_BITS | (c & (TILE_SIZE - 1)));
+}
+
+static inline int is_water(int v) {
+    return v == -1 || v == -3 || v == -4 || v == -5;
+}
+
+// Navigable channels: a berth can only be reached if its water is connected to
+// the port entrance (the last row) through free slots, oil pumps and open water.
+// Every water slot carries the label of its connected component and every
+// component counts its entrance slots, so the check is O(1). Labels are kept up
+// to date on every grid write instead of being recomputed per search:
+// - a release labels the freed rectangle and merges it with the components
+//   around it, relabelling the smaller side of each merge;
+// - a docking yacht can only split the component it sits in. One flood fill
+//   grows from each piece around the yacht in lockstep, fills that meet are
+//   joined, and every fill that runs out before the last one left is a piece
+//   of its own. Only those (smaller) pieces are relabelled.
+// The labels are kept per node: every slot of a populated tile is a node, with
+// the index of the slot in port, and every tile of open water is a single node
+// after those (all of its slots are water and connected), so the labels take
+// memory for the dockable area and a flood crosses open water a tile at a time.
+atomic_int* reach_label;          // Component of every node, -1 for quays and yachts
+atomic_int* reach_entrance;       // Entrance slots of every component, by label
+int* reach_size;                  // Slots of every component, by label
+int* reach_free_labels;           // Unused labels (stack)
+int reach_free_count;
+int* reach_stamp;                 // Epoch of the split check that last visited a node
+int* reach_owner;                 // Flood fill that visited a node in the current split check
+int* reach_next;                  // Frontier lists of the lockstep flood fills, -1 terminated
+int* reach_queue;                 // Queue of relabelling floods
+int reach_open_base;              // Node of the first open water tile
+int reach_nodes;
+int reach_epoch;                  // Stamp of the current split check
+unsigned long reach_gains;        // Bumped when slots outside a written rectangle become reachable
+long reach_updates;               // Grid writes processed
+long reach_visited;               // Slots visited by the incremental updates
+
+#define REACH_MAX_NEIGHBOURS (4 * TILE_SIZE) // An open water tile borders on up to 4 rows of slots
+
+// Node of slot (r, c)
+static inline int reach_node(int r, int c) {
+    int t = port_tile_dir[(r >> TILE_BITS) * port_tile_cols + (c >> TILE_BITS)];
+    if (t < 0)
+        return reach_open_base - 1 - t;
+    return t * TILE_CELLS + ((r & (TILE_SIZE - 1)) << TILE_BITS | (c & (TILE_SIZE - 1)));
+}
+
+// Slot rows [r0, r1] and columns [c0, c1] of the tile with the given tile coordinates
+static inline void tile_bounds(int tile_row, int tile_col, int* r0, int* r1, int* c0, int* c1) {
+    *r0 = tile_row * TILE_SIZE;
+    *c0 = tile_col * TILE_SIZE;
+    *r1 = *r0 + TILE_SIZE <= port_rows ? *r0 + TILE_SIZE - 1 : port_rows - 1;
+    *c1 = *c0 + TILE_SIZE <= port_cols ? *c0 + TILE_SIZE - 1 : port_cols - 1;
+}
+
+static inline int reach_water(int node) {
+    return node >= reach_open_base || is_water(atomic_load(&port[node].occupied));
+}
+
+// Slots of a node, and how many of them are in the entrance row
+static void reach_node_slots(int node, int* slots, int* entrance) {
+    int r0, r1, c0, c1;
+    if (node < reach_open_base) {
+        const PortTile* t = &port_tiles[node / TILE_CELLS];
+        *slots = 1;
+        *entrance = t->row * TILE_SIZE + (node % TILE_CELLS >> TILE_BITS) == port_rows - 1;
+        return;
+    }
+    const PortTile* t = &port_open_tiles[node - reach_open_base];
+    tile_bounds(t->row, t->col, &r0, &r1, &c0, &c1);
+    *slots = (r1 - r0 + 1) * (c1 - c0 + 1);
+    *entrance = r1 == port_rows - 1 ? c1 - c0 + 1 : 0;
+}
+
+// Whether the berth with top-left slot (r, c) is connected to the port entrance
+static inline int berth_reachable(int r, int c) {
+    int label = atomic_load(&reach_label[reach_node(r, c)]);
+    return label >= 0 && atomic_load(&reach_entrance[label]) > 0;
+}
+
+// Water neighbours of a node (up to 4 for a slot, REACH_MAX_NEIGHBOURS for a
+// tile of open water), returns their number
+static int reach_neighbours(int node, int* out) {
+    int n = 0;
+    if (node < reach_open_base) {
+        const PortTile* t = &port_tiles[node / TILE_CELLS];
+        int r = t->row * TILE_SIZE + (node % TILE_CELLS >> TILE_BITS), c = t->col * TILE_SIZE + (node & (TILE_SIZE - 1));
+        if (r > 0) out[n++] = reach_node(r - 1, c);
+        if (r + 1 < port_rows) out[n++] = reach_node(r + 1, c);
+        if (c > 0) out[n++] = reach_node(r, c - 1);
+        if (c + 1 < port_cols) out[n++] = reach_node(r, c + 1);
+    } else {
+        // The neighbouring tile as one node if it is open water, else the slots along the edge
+        const PortTile* t = &port_open_tiles[node - reach_open_base];
+        int r0, r1, c0, c1;
+        tile_bounds(t->row, t->col, &r0, &r1, &c0, &c1);
+        int rows[2] = {r0 - 1, r1 + 1}, cols[2] = {c0 - 1, c1 + 1};
+        for (int k = 0; k < 2; k++) {
+            if (rows[k] < 0 || rows[k] >= port_rows)
+                continue;
+            if (slot_index(rows[k], c0) < 0)
+                out[n++] = reach_node(rows[k], c0);
+            else
+                for (int c = c0; c <= c1; c++)
+                    out[n++] = reach_node(rows[k], c);
+        }
+        for (int k = 0; k < 2; k++) {
+            if (cols[k] < 0 || cols[k] >= port_cols)
+                continue;
+            if (slot_index(r0, cols[k]) < 0)
+                out[n++] = reach_node(r0, cols[k]);
+            else
+                for (int r = r0; r <= r1; r++)
+                    out[n++] = reach_node(r, cols[k]);
+        }
+    }
+    int m = 0;
+    for (int i = 0; i < n; i++)
+        if (reach_water(out[i]))
+            out[m++] = out[i];
+    return m;
+}
+
+// Move the component containing node 'start' (label 'from') to label 'to'
+static void reach_relabel(int start, int from, int to) {
+    long head = 0, tail = 0;
+    atomic_store(&reach_label[start], to);
+    reach_queue[tail++] = start;
+    int size = 0, entrance = 0;
+    while (head < tail) {
+        int idx = reach_queue[head++], nb[REACH_MAX_NEIGHBOURS], slots, gate;
+        reach_node_slots(idx, &slots, &gate);
+        size += slots;
+        entrance += gate;
+        int n = reach_neighbours(idx, nb);
+        for (int i = 0; i < n; i++)
+            if (atomic_load(&reach_label[nb[i]]) == from) {
+                atomic_store(&reach_label[nb[i]], to);
+                reach_queue[tail++] = nb[i];
+            }
+    }
+    reach_visited += size;
+    reach_size[from] -= size;
+    atomic_fetch_sub(&reach_entrance[from], entrance);
+    reach_size[to] += size;
+    atomic_fetch_add(&reach_entrance[to], entrance);
+    if (reach_size[from] == 0)
+        reach_free_labels[reach_free_count++] = from;
+}
+
+static int reach_new_label() {
+    int label = reach_free_labels[--reach_free_count];
+    reach_size[label] = 0;
+    atomic_store(&reach_entrance[label], 0);
+    return label;
+}
+
+// Label all water of the port from scratch, -1 if out of memory
+int reach_init() {
+    reach_open_base = port_tile_count * TILE_CELLS;
+    reach_nodes = reach_open_base + port_open_count;
+    size_t nodes = reach_nodes;
+    reach_label = (atomic_int*)arena_alloc(nodes * sizeof(atomic_int));
+    reach_entrance = (atomic_int*)arena_alloc(nodes * sizeof(atomic_int));
+    reach_size = (int*)arena_alloc(nodes * sizeof(int));
+    reach_free_labels = (int*)arena_alloc(nodes * sizeof(int));
+    reach_stamp = (int*)arena_alloc(nodes * sizeof(int));
+    reach_owner = (int*)arena_alloc(nodes * sizeof(int));
+    reach_next = (int*)arena_alloc(nodes * sizeof(int));
+    reach_queue = (int*)arena_alloc(nodes * sizeof(int));
+    if (!reach_label || !reach_entrance || !reach_size || !reach_free_labels ||
+        !reach_stamp || !reach_owner || !reach_next || !reach_queue)
+        return -1;
+    reach_free_count = 0;
+    for (long i = (long)nodes - 1; i >= 0; i--)
+        reach_free_labels[reach_free_count++] = i;
+    for (size_t i = 0; i < nodes; i++) {
+        atomic_store(&reach_label[i], -1);
+        reach_stamp[i] = 0;
+    }
+    reach_epoch = 0;
+    reach_gains = reach_updates = reach_visited = 0;
+    for (int i = 0; i < reach_nodes; i++) {
+        if (!reach_water(i) || atomic_load(&reach_label[i]) >= 0)
+            continue;
+        int label = reach_new_label();
+        long head = 0, tail = 0;
+        atomic_store(&reach_label[i], label);
+        reach_queue[tail++] = i;
+        while (head < tail) {
+            int idx = reach_queue[head++], nb[REACH_MAX_NEIGHBOURS], slots, gate;
+            reach_node_slots(idx, &slots, &gate);
+            reach_size[label] += slots;
+            atomic_fetch_add(&reach_entrance[label], gate);
+            int n = reach_neighbours(idx, nb);
+            for (int k = 0; k < n; k++)
+                if (atomic_load(&reach_label[nb[k]]) < 0) {
+                    atomic_store(&reach_label[nb[k]], label);
+                    reach_queue[tail++] = nb[k];
+                }
+        }
+    }
+    return 0;
+}
+
+// Freed rectangle: label it and merge it with the neighbouring components
+static void reach_release(int r, int c, int slots_length, int slots_width) {
+    int label = reach_new_label();
+    for (int i = r; i < r + slots_length; i++)
+        for (int j = c; j < c + slots_width; j++) {
+            atomic_store(&reach_label[reach_node(i, j)], label);
+            reach_size[label]++;
+            if (i == port_rows - 1)
+                atomic_fetch_add(&reach_entrance[label], 1);
+        }
+    int top_left = reach_node(r, c), closed_neighbour = 0;
+    for (int i = r - 1; i <= r + slots_length; i++)
+        for (int j = c - 1; j <= c + slots_width; j++) {
+            if (i < 0 || j < 0 || i >= port_rows || j >= port_cols)
+                continue;
+            int on_edge_row = i == r - 1 || i == r + slots_length, on_edge_col = j == c - 1 || j == c + slots_width;
+            if (on_edge_row == on_edge_col) // Inside or diagonal
+                continue;
+            int idx = reach_node(i, j);
+            int other = atomic_load(&reach_label[idx]);
+            int own = atomic_load(&reach_label[top_left]);
+            if (other < 0 || other == own) // Not water, or water freed later in the same batch
+                continue;
+            closed_neighbour |= atomic_load(&reach_entrance[other]) == 0;
+            if (reach_size[other] < reach_size[own])
+                reach_relabel(idx, other, own);
+            else
+                reach_relabel(top_left, own, other);
+        }
+    if (closed_neighbour && atomic_load(&reach_entrance[atomic_load(&reach_label[top_left])]) > 0)
+        reach_gains++;
+}
+
+// Docked rectangle: drop its slots and split off the pieces it disconnected. A
+// yacht has at most 2 * (length + width) water slots around it.
+#define REACH_MAX_SEEDS (2 * (MAX_SLOTS_LENGTH + MAX_SLOTS_WIDTH))
+
+static void reach_dock(int r, int c, int slots_length, int slots_width) {
+    int label = atomic_load(&reach_label[reach_node(r, c)]);
+    for (int i = r; i < r + slots_length; i++)
+        for (int j = c; j < c + slots_width; j++) {
+            atomic_store(&reach_label[reach_node(i, j)], -1);
+            reach_size[label]--;
+            if (i == port_rows - 1)
+                atomic_fetch_sub(&reach_entrance[label], 1);
+        }
+
+    // One fill per water node around the yacht; fills that meet are joined in a small union-find
+    int seeds[REACH_MAX_SEEDS], group[REACH_MAX_SEEDS], head[REACH_MAX_SEEDS], tail[REACH_MAX_SEEDS];
+    int open[REACH_MAX_SEEDS]; // Fills of a group with a non-empty frontier, by root
+    int fills = 0, active = 0;
+    reach_epoch++;
+    for (int i = r - 1; i <= r + slots_length; i++)
+        for (int j = c - 1; j <= c + slots_width; j++) {
+            if (i < 0 || j < 0 || i >= port_rows || j >= port_cols)
+                continue;
+            int on_edge_row = i == r - 1 || i == r + slots_length, on_edge_col = j == c - 1 || j == c + slots_width;
+            if (on_edge_row == on_edge_col)
+                continue;
+            int idx = reach_node(i, j);
+            if (atomic_load(&reach_label[idx]) != label || reach_stamp[idx] == reach_epoch)
+                continue;
+            reach_stamp[idx] = reach_epoch;
+            reach_owner[idx] = fills;
+            reach_next[idx] = -1;
+            seeds[fills] = idx;
+            group[fills] = fills;
+            head[fills] = tail[fills] = idx;
+            open[fills] = 1;
+            fills++;
+            active++;
+        }
+    while (active > 1) {
+        for (int f = 0; f < fills && active > 1; f++) {
+            if (head[f] < 0)
+                continue;
+            int idx = head[f], nb[REACH_MAX_NEIGHBOURS];
+            head[f] = reach_next[idx];
+            if (head[f] < 0)
+                tail[f] = -1;
+            reach_visited++;
+            int n = reach_neighbours(idx, nb);
+            int root = f;
+            while (group[root] != root)
+                root = group[root];
+            for (int i = 0; i < n; i++) {
+                if (atomic_load(&reach_label[nb[i]]) != label)
+                    continue;
+                if (reach_stamp[nb[i]] != reach_epoch) {
+                    reach_stamp[nb[i]] = reach_epoch;
+                    reach_owner[nb[i]] = f;
+                    reach_next[nb[i]] = -1;
+                    if (tail[f] >= 0)
+                        reach_next[tail[f]] = nb[i];
+                    else
+                        head[f] = nb[i];
+                    tail[f] = nb[i];
+                    continue;
+                }
+                int other = reach_owner[nb[i]];
+                while (group[other] != other)
+                    other = group[other];
+                if (other != root) {
+                    // Two fills met: their pieces are one
+                    group[other] = root;
+                    open[root] += open[other];
+                    active--;
+                }
+            }
+            if (head[f] < 0 && --open[root] == 0 && active > 1) {
+                // The group ran out first: it is a piece of its own
+                reach_relabel(seeds[root], label, reach_new_label());
+                active--;
+            }
+        }
+    }
+    if (reach_size[label] == 0)
+        reach_free_labels[reach_free_count++] = label;
+}
+
+// Bring the labels up to date after a write of the rectangle at (r, c). A write
+// turns the whole rectangle from water to land or back, or leaves it water.
+void reach_update(int r, int c, int slots_length, int slots_width) {
+    int top_left = reach_node(r, c);
+    int water = reach_water(top_left), labelled = atomic_load(&reach_label[top_left]) >= 0;
+    if (water == labelled)
+        return; // Still water (a slot kept clear or freed from it), or still taken
+    reach_updates++;
+    if (water)
+        reach_release(r, c, slots_length, slots_width);
+    else
+        reach_dock(r, c, slots_length, slots_width);
+}
+
+// Check if a yacht can dock at a given position
+int can_dock_here(int r, int c, int slots_length, int slots_width, int required_id) {
+    for (int i = 0; i < slots_length; i++) {
+        for (int j = 0; j < slots_width; j++) {
+            if (r + i >= port_rows || c + j >= port_cols)
+                return 0;
+            if (atomic_load(&CELL(r + i, c + j).occupied) != required_id)
+                return 0;
+        }
+    }
+    return berth_reachable(r, c);
+}
+
+// Distance from the nearest quay of row r to a yacht covering columns [c, c + slots_width)
+static int scan_quay_distance(int r, int c, int slots_width) {
+    int min_distance = port_cols * SLOT_SIZE;
+    for (int j = c; j < c + slots_width; j++) {
+        int left = j, right = j;
+        int left_dist = port_cols * SLOT_SIZE, right_dist = port_cols * SLOT_SIZE;
+        while (left >= 0) {
+            if (atomic_load(&CELL(r, left).occupied) == -2) {
+                left_dist = j - left; break;
+            }
+            left--;
+        }
+        while (right < port_cols) {
+            if (atomic_load(&CELL(r, right).occupied) == -2) {
+                right_dist = right - j; break;
+            }
+            right++;
+        }
+        int local_min = (left_dist < right_dist) ? left_dist : right_dist;
+        if (local_min < min_distance)
+            min_distance = local_min;
+    }
+    return min_distance;
+}
+
+// Find the best docking spot for a yacht by checking every position (reference backend)
+void scan_find_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id) {
+    *best_r = -1;
+    *best_c = -1;
+    *best_quay_distance = port_cols * SLOT_SIZE;
+
+    for (int r = 0; r <= port_rows - slots_length; r++) {
+        for (int c = 0; c <= port_cols - slots_width; c++) {
+            if (can_dock_here(r, c, slots_length, slots_width, required_id)) {
+                int min_distance = scan_quay_distance(r, c, slots_width);
+                if (min_distance < *best_quay_distance) {
+                    *best_quay_distance = min_distance;
+                    *best_r = r;
+                    *best_c = c;
+                }
+            }
+        }
+    }
+}
+
+// Berth class index of a slot value (0 = free, 1 = oil pump), -1 for quays and yachts
+static int berth_class(int value) {
+    return value == -1 ? 0 : value == -3 ? 1 : -1;
+}
+
+// Reset the per-class results of a multi-class search
+static void clear_spots(DockSpot* best) {
+    for (int k = 0; k < 2; k++) {
+        best[k].r = best[k].c = -1;
+        best[k].quay_distance = port_cols * SLOT_SIZE;
+    }
+}
+
+// Keep a candidate if it beats the current best of its class
+static inline void offer_spot(DockSpot* best, int r, int c, int distance) {
+    if (distance < best->quay_distance) {
+        best->quay_distance = distance;
+        best->r = r;
+        best->c = c;
+    }
+}
+
+// One scan over the grid for several berth classes: the class of the top-left
+// slot decides which class a position can serve
+void scan_find_multi(int slots_length, int slots_width, int classes, DockSpot* best) {
+    clear_spots(best);
+    for (int r = 0; r <= port_rows - slots_length; r++)
+        for (int c = 0; c <= port_cols - slots_width; c++) {
+            int value = atomic_load(&CELL(r, c).occupied);
+            int k = berth_class(value);
+            if (k >= 0 && ((classes >> k) & 1) && can_dock_here(r, c, slots_length, slots_width, value))
+                offer_spot(&best[k], r, c, scan_quay_distance(r, c, slots_width));
+        }
+}
+
+// Histogram backend: hist_down[cell] is the number of consecutive slots with the
+// same value starting at the cell and going down its column. A position fits an
+// L x W yacht iff W adjacent slots of its row hold the required value with
+// hist_down >= L, so one row-major sweep with a monotonic deque for the minimum
+// quay distance over the window answers a query in O(rows x cols).
+int* hist_down;
+int* hist_deque;
+
+// Recompute the column runs of the cells in rows [r0, r1) of column c and above them
+static void hist_fix_column(int r0, int r1, int c) {
+    for (int r = r1 - 1; r >= 0; r--) {
+        int v = atomic_load(&CELL(r, c).occupied);
+        int down = (r + 1 < port_rows && atomic_load(&CELL(r + 1, c).occupied) == v)
+            ? hist_down[(size_t)(r + 1) * port_cols + c] + 1 : 1;
+        int* cur = &hist_down[(size_t)r * port_cols + c];
+        if (r < r0 && *cur == down)
+            break; // Runs above an unchanged cell are unchanged too
+        *cur = down;
+    }
+}
+
+int hist_init() {
+    hist_down = (int*)arena_alloc((size_t)port_rows * port_cols * sizeof(int));
+    hist_deque = (int*)arena_alloc((size_t)port_cols * 2 * sizeof(int));
+    if (!hist_down || !hist_deque)
+        return -1;
+    for (int c = 0; c < port_cols; c++)
+        hist_fix_column(0, port_rows, c);
+    return 0;
+}
+
+void hist_update(int r, int c, int slots_length, int slots_width) {
+    for (int j = c; j < c + slots_width; j++)
+        hist_fix_column(r, r + slots_length, j);
+}
+
+void hist_find_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id) {
+    *best_r = -1;
+    *best_c = -1;
+    *best_quay_distance = port_cols * SLOT_SIZE;
+
+    for (int r = 0; r <= port_rows - slots_length; r++) {
+        const int* down = &hist_down[(size_t)r * port_cols];
+        int run = 0, head = 0, tail = 0;
+        for (int c = 0; c < port_cols; c++) {
+            if (atomic_load(&CELL(r, c).occupied) != required_id || down[c] < slots_length) {
+                run = 0;
+                head = tail = 0;
+                continue;
+            }
+            run++;
+            // Keep deque columns in increasing quay distance, dropping those left of the window
+            while (tail > head && CELL(r, hist_deque[tail - 1]).quay_distance >= CELL(r, c).quay_distance)
+                tail--;
+            hist_deque[tail++] = c;
+            if (hist_deque[head] <= c - slots_width)
+                head++;
+            if (run >= slots_width && berth_reachable(r, c - slots_width + 1)) {
+                int distance = CELL(r, hist_deque[head]).quay_distance;
+                if (distance < *best_quay_distance) {
+                    *best_quay_distance = distance;
+                    *best_r = r;
+                    *best_c = c - slots_width + 1;
+                }
+            }
+        }
+    }
+}
+
+// One sweep for several berth classes, with a window and deque per class
+void hist_find_multi(int slots_length, int slots_width, int classes, DockSpot* best) {
+    clear_spots(best);
+    for (int r = 0; r <= port_rows - slots_length; r++) {
+        const int* down = &hist_down[(size_t)r * port_cols];
+        int run[2] = {0, 0}, head[2] = {0, 0}, tail[2] = {0, 0};
+        for (int c = 0; c < port_cols; c++) {
+            int k = berth_class(atomic_load(&CELL(r, c).occupied));
+            for (int m = 0; m < 2; m++) {
+                if (m != k || !((classes >> m) & 1) || down[c] < slots_length) {
+                    run[m] = head[m] = tail[m] = 0;
+                    continue;
+                }
+                int* deque = &hist_deque[m * port_cols];
+                run[m]++;
+                while (tail[m] > head[m] && CELL(r, deque[tail[m] - 1]).quay_distance >= CELL(r, c).quay_distance)
+                    tail[m]--;
+                deque[tail[m]++] = c;
+                if (deque[head[m]] <= c - slots_width)
+                    head[m]++;
+                if (run[m] >= slots_width && berth_reachable(r, c - slots_width + 1))
+                    offer_spot(&best[m], r, c - slots_width + 1, CELL(r, deque[head[m]]).quay_distance);
+            }
+        }
+    }
+}
+
+// Quay distance score of a position, as computed by the scan
+static int quay_score(int r, int c, int slots_width) {
+    int distance = port_cols * SLOT_SIZE;
+    for (int j = c; j < c + slots_width; j++)
+        if (CELL(r, j).quay_distance < distance)
+            distance = CELL(r, j).quay_distance;
+    return distance;
+}
+
+// Pyramid backend: pyr_run[cell] is the number of consecutive slots with the same
+// value starting at the cell and going right. Every 8x8 block and every 64x64
+// super block keeps, per berth class (free / oil pump), the number of such slots
+// and the longest run starting inside it, so the search skips whole regions
+// that cannot hold the requested width. Updates touch O(levels) summaries.
+#define PYR_BLOCK 8
+#define PYR_SUPER 64
+#define PYR_FANOUT (PYR_SUPER / PYR_BLOCK)
+
+typedef struct {
+    int count[2];                 // Slots of the class (0 = free, 1 = oil pump)
+    int max_run[2];               // Longest run of the class starting in the region
+} PyrSummary;
+
+int* pyr_run;
+PyrSummary* pyr_blocks;
+PyrSummary* pyr_supers;
+int pyr_block_rows, pyr_block_cols, pyr_super_rows, pyr_super_cols;
+
+// Recompute the runs of row r after slots [c0, c1) changed, returns the leftmost column touched
+static int pyr_fix_row(int r, int c0, int c1) {
+    int* run = &pyr_run[(size_t)r * port_cols];
+    int c = c1 - 1;
+    for (; c >= 0; c--) {
+        int v = atomic_load(&CELL(r, c).occupied);
+        int len = (c + 1 < port_cols && atomic_load(&CELL(r, c + 1).occupied) == v) ? run[c + 1] + 1 : 1;
+        if (c < c0 && run[c] == len)
+            break; // Runs further left are unchanged
+        run[c] = len;
+    }
+    return c + 1;
+}
+
+// Rebuild the summary of one 8x8 block from its slots
+static void pyr_fix_block(int br, int bc) {
+    PyrSummary* b = &pyr_blocks[(size_t)br * pyr_block_cols + bc];
+    memset(b, 0, sizeof(*b));
+    for (int r = br * PYR_BLOCK; r < (br + 1) * PYR_BLOCK && r < port_rows; r++)
+        for (int c = bc * PYR_BLOCK; c < (bc + 1) * PYR_BLOCK && c < port_cols; c++) {
+            int k = berth_class(atomic_load(&CELL(r, c).occupied));
+            if (k < 0)
+                continue;
+            b->count[k]++;
+            int run = pyr_run[(size_t)r * port_cols + c];
+            if (run > b->max_run[k])
+                b->max_run[k] = run;
+        }
+}
+
+// Rebuild the summary of one 64x64 super block from its blocks
+static void pyr_fix_super(int sr, int sc) {
+    PyrSummary* sp = &pyr_supers[(size_t)sr * pyr_super_cols + sc];
+    memset(sp, 0, sizeof(*sp));
+    for (int br = sr * PYR_FANOUT; br < (sr + 1) * PYR_FANOUT && br < pyr_block_rows; br++)
+        for (int bc = sc * PYR_FANOUT; bc < (sc + 1) * PYR_FANOUT && bc < pyr_block_cols; bc++) {
+            PyrSummary* b = &pyr_blocks[(size_t)br * pyr_block_cols + bc];
+            for (int k = 0; k < 2; k++) {
+                sp->count[k] += b->count[k];
+                if (b->max_run[k] > sp->max_run[k])
+                    sp->max_run[k] = b->max_run[k];
+            }
+        }
+}
+
+void pyr_update(int r, int c, int slots_length, int slots_width) {
+    int left = c;
+    for (int i = r; i < r + slots_length; i++) {
+        int lo = pyr_fix_row(i, c, c + slots_width);
+        if (lo < left)
+            left = lo;
+    }
+    for (int br = r / PYR_BLOCK; br <= (r + slots_length - 1) / PYR_BLOCK; br++)
+        for (int bc = left / PYR_BLOCK; bc <= (c + slots_width - 1) / PYR_BLOCK; bc++)
+            pyr_fix_block(br, bc);
+    for (int sr = r / PYR_SUPER; sr <= (r + slots_length - 1) / PYR_SUPER; sr++)
+        for (int sc = left / PYR_SUPER; sc <= (c + slots_width - 1) / PYR_SUPER; sc++)
+            pyr_fix_super(sr, sc);
+}
+
+int pyr_init() {
+    pyr_block_rows = (port_rows + PYR_BLOCK - 1) / PYR_BLOCK;
+    pyr_block_cols = (port_cols + PYR_BLOCK - 1) / PYR_BLOCK;
+    pyr_super_rows = (port_rows + PYR_SUPER - 1) / PYR_SUPER;
+    pyr_super_cols = (port_cols + PYR_SUPER - 1) / PYR_SUPER;
+    pyr_run = (int*)arena_alloc((size_t)port_rows * port_cols * sizeof(int));
+    pyr_blocks = (PyrSummary*)arena_alloc((size_t)pyr_block_rows * pyr_block_cols * sizeof(PyrSummary));
+    pyr_supers = (PyrSummary*)arena_alloc((size_t)pyr_super_rows * pyr_super_cols * sizeof(PyrSummary));
+    if (!pyr_run || !pyr_blocks || !pyr_supers)
+        return -1;
+    for (int r = 0; r < port_rows; r++)
+        pyr_fix_row(r, 0, port_cols);
+    for (int br = 0; br < pyr_block_rows; br++)
+        for (int bc = 0; bc < pyr_block_cols; bc++)
+            pyr_fix_block(br, bc);
+    for (int sr = 0; sr < pyr_super_rows; sr++)
+        for (int sc = 0; sc < pyr_super_cols; sc++)
+            pyr_fix_super(sr, sc);
+    return 0;
+}
+
+void pyr_find_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id) {
+    *best_r = -1;
+    *best_c = -1;
+    *best_quay_distance = port_cols * SLOT_SIZE;
+    int k = berth_class(required_id);
+    if (k < 0)
+        return;
+
+    // Rows are visited in order and columns left to right, so ties resolve like the scan
+    for (int r = 0; r <= port_rows - slots_length; r++) {
+        const PyrSummary* supers = &pyr_supers[(size_t)(r / PYR_SUPER) * pyr_super_cols];
+        const PyrSummary* blocks = &pyr_blocks[(size_t)(r / PYR_BLOCK) * pyr_block_cols];
+        for (int sc = 0; sc < pyr_super_cols; sc++) {
+            if (supers[sc].count[k] == 0 || supers[sc].max_run[k] < slots_width)
+                continue;
+            int bc_end = (sc + 1) * PYR_FANOUT < pyr_block_cols ? (sc + 1) * PYR_FANOUT : pyr_block_cols;
+            for (int bc = sc * PYR_FANOUT; bc < bc_end; bc++) {
+                if (blocks[bc].count[k] == 0 || blocks[bc].max_run[k] < slots_width)
+                    continue;
+                int c_end = (bc + 1) * PYR_BLOCK;
+                if (c_end > port_cols - slots_width + 1)
+                    c_end = port_cols - slots_width + 1;
+                for (int c = bc * PYR_BLOCK; c < c_end; c++) {
+                    int fits = 1;
+                    for (int i = 0; i < slots_length && fits; i++)
+                        fits = atomic_load(&CELL(r + i, c).occupied) == required_id &&
+                            pyr_run[(size_t)(r + i) * port_cols + c] >= slots_width;
+                    if (!fits || !berth_reachable(r, c))
+                        continue;
+                    int distance = quay_score(r, c, slots_width);
+                    if (distance < *best_quay_distance) {
+                        *best_quay_distance = distance;
+                        *best_r = r;
+                        *best_c = c;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// One pass over the unskipped blocks for several berth classes
+void pyr_find_multi(int slots_length, int slots_width, int classes, DockSpot* best) {
+    clear_spots(best);
+    for (int r = 0; r <= port_rows - slots_length; r++) {
+        const PyrSummary* supers = &pyr_supers[(size_t)(r / PYR_SUPER) * pyr_super_cols];
+        const PyrSummary* blocks = &pyr_blocks[(size_t)(r / PYR_BLOCK) * pyr_block_cols];
+        for (int sc = 0; sc < pyr_super_cols; sc++) {
+            int open = 0;
+            for (int k = 0; k < 2; k++)
+                open |= ((classes >> k) & 1) && supers[sc].count[k] > 0 && supers[sc].max_run[k] >= slots_width;
+            if (!open)
+                continue;
+            int bc_end = (sc + 1) * PYR_FANOUT < pyr_block_cols ? (sc + 1) * PYR_FANOUT : pyr_block_cols;
+            for (int bc = sc * PYR_FANOUT; bc < bc_end; bc++) {
+                int want = 0;
+                for (int k = 0; k < 2; k++)
+                    if (((classes >> k) & 1) && blocks[bc].count[k] > 0 && blocks[bc].max_run[k] >= slots_width)
+                        want |= 1 << k;
+                if (!want)
+                    continue;
+                int c_end = (bc + 1) * PYR_BLOCK;
+                if (c_end > port_cols - slots_width + 1)
+                    c_end = port_cols - slots_width + 1;
+                for (int c = bc * PYR_BLOCK; c < c_end; c++) {
+                    int value = atomic_load(&CELL(r, c).occupied);
+                    int k = berth_class(value);
+                    if (k < 0 || !((want >> k) & 1))
+                        continue;
+                    int fits = 1;
+                    for (int i = 0; i < slots_length && fits; i++)
+                        fits = atomic_load(&CELL(r + i, c).occupied) == value &&
+                            pyr_run[(size_t)(r + i) * port_cols + c] >= slots_width;
+                    if (fits && berth_reachable(r, c))
+                        offer_spot(&best[k], r, c, quay_score(r, c, slots_width));
+                }
+            }
+        }
+    }
+}
+
+// Ordered backend: quay distances never change, so for every yacht width and
+// berth class the candidate top-left positions are precomputed in ascending
+// (quay distance, row, column) order. The first candidate that fits is then the
+// spot the scan would pick, and the search stops there. The score of a position
+// depends on its width only, so the length needs no classes of its own.
+#define ORD_MAX_WIDTH ((YACHT_MAX_WIDTH + SLOT_SIZE - 1) / SLOT_SIZE)
+
+uint32_t* ord_cands[ORD_MAX_WIDTH + 1][2];  // Slot indexes (row * port_cols + col) in search order
+long ord_count[ORD_MAX_WIDTH + 1][2];
+
+int ord_init() {
+    int max_score = port_cols * SLOT_SIZE;
+    long* bucket = (long*)calloc(max_score + 1, sizeof(long));
+    if (!bucket)
+        return -1;
+    for (int w = 1; w <= ORD_MAX_WIDTH; w++) {
+        for (int k = 0; k < 2; k++) {
+            int base = k == 0 ? -1 : -3;
+            // Counting sort on the score; filling in row-major order keeps ties in scan order
+            memset(bucket, 0, (max_score + 1) * sizeof(long));
+            for (int r = 0; r < port_rows; r++)
+                for (int c = 0; c + w <= port_cols; c++) {
+                    int usable = 1;
+                    for (int j = c; j < c + w && usable; j++)
+                        usable = CELL(r, j).base == base;
+                    if (usable && quay_score(r, c, w) < max_score)
+                        bucket[quay_score(r, c, w) + 1]++;
+                }
+            for (int d = 1; d <= max_score; d++)
+                bucket[d] += bucket[d - 1];
+            ord_count[w][k] = bucket[max_score];
+            ord_cands[w][k] = (uint32_t*)arena_alloc(ord_count[w][k] * sizeof(uint32_t));
+            if (!ord_cands[w][k]) {
+                free(bucket);
+                return -1;
+            }
+            for (int r = 0; r < port_rows; r++)
+                for (int c = 0; c + w <= port_cols; c++) {
+                    int usable = 1;
+                    for (int j = c; j < c + w && usable; j++)
+                        usable = CELL(r, j).base == base;
+                    int score = quay_score(r, c, w);
+                    if (usable && score < max_score)
+                        ord_cands[w][k][bucket[score]++] = (uint32_t)((size_t)r * port_cols + c);
+                }
+        }
+    }
+    free(bucket);
+    return 0;
+}
+
+void ord_find_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id) {
+    int k = required_id == -1 ? 0 : required_id == -3 ? 1 : -1;
+    if (k < 0 || slots_width < 1 || slots_width > ORD_MAX_WIDTH) {
+        scan_find_docking_spot(slots_length, slots_width, best_r, best_c, best_quay_distance, required_id);
+        return;
+    }
+    *best_r = -1;
+    *best_c = -1;
+    *best_quay_distance = port_cols * SLOT_SIZE;
+
+    const uint32_t* cand = ord_cands[slots_width][k];
+    for (long i = 0; i < ord_count[slots_width][k]; i++) {
+        int r = cand[i] / port_cols, c = cand[i] % port_cols;
+        if (r + slots_length > port_rows || !can_dock_here(r, c, slots_length, slots_width, required_id))
+            continue;
+        *best_quay_distance = quay_score(r, c, slots_width);
+        *best_r = r;
+        *best_c = c;
+        return;
+    }
+}
+
+// Cached backend: the best spot of every footprint class (length x width x berth
+// class) is kept between searches. Docking only invalidates classes whose cached
+// spot it overlaps; a release invalidates the classes of its berth class that a
+// spot overlapping the freed slots could beat. Misses are answered by 'ordered'.
+#define ORD_MAX_LENGTH ((YACHT_MAX_LENGTH + SLOT_SIZE - 1) / SLOT_SIZE)
+
+typedef struct {
+    int valid;                    // Whether the entry reflects the current grid
+    unsigned long reach_gains;    // reach_gains when the entry was computed
+    int r, c;                     // Best spot, -1 if the class does not fit anywhere
+    int score;                    // Quay distance of the best spot
+} CacheEntry;
+
+CacheEntry cache_entries[ORD_MAX_LENGTH + 1][ORD_MAX_WIDTH + 1][2];
+long cache_hits, cache_misses, cache_invalidations;
+
+int cache_init() {
+    memset(cache_entries, 0, sizeof(cache_entries));
+    cache_hits = cache_misses = cache_invalidations = 0;
+    return ord_init();
+}
+
+void cache_update(int r, int c, int slots_length, int slots_width) {
+    // A released berth may come back partly kept clear (-4), so look at every slot
+    int taken = 0, value = 0;
+    for (int i = r; i < r + slots_length; i++)
+        for (int j = c; j < c + slots_width; j++) {
+            int v = atomic_load(&CELL(i, j).occupied);
+            if (v == -1 || v == -3)
+                value = v;
+            else
+                taken = 1;
+        }
+    if (taken) {
+        // Docked or kept clear: only entries whose spot overlaps the slots can be affected
+        for (int l = 1; l <= ORD_MAX_LENGTH; l++)
+            for (int w = 1; w <= ORD_MAX_WIDTH; w++)
+                for (int k = 0; k < 2; k++) {
+                    CacheEntry* e = &cache_entries[l][w][k];
+                    if (e->valid && e->r >= 0 && e->r < r + slots_length && r < e->r + l &&
+                        e->c < c + slots_width && c < e->c + w) {
+                        e->valid = 0;
+                        cache_invalidations++;
+                    }
+                }
+    }
+    if (value == 0)
+        return;
+
+    // Released: a new spot must overlap the freed slots, so its score is at least
+    // the smallest quay distance within reach of them
+    int k = value == -1 ? 0 : 1;
+    for (int w = 1; w <= ORD_MAX_WIDTH; w++) {
+        int bound = port_cols * SLOT_SIZE;
+        int r0 = r - ORD_MAX_LENGTH + 1 < 0 ? 0 : r - ORD_MAX_LENGTH + 1;
+        int c0 = c - w + 1 < 0 ? 0 : c - w + 1;
+        int c1 = c + slots_width + w - 1 > port_cols ? port_cols : c + slots_width + w - 1;
+        for (int i = r0; i < r + slots_length; i++)
+            for (int j = c0; j < c1; j++)
+                if (CELL(i, j).quay_distance < bound)
+                    bound = CELL(i, j).quay_distance;
+        for (int l = 1; l <= ORD_MAX_LENGTH; l++) {
+            CacheEntry* e = &cache_entries[l][w][k];
+            if (e->valid && (e->r < 0 || bound <= e->score)) {
+                e->valid = 0;
+                cache_invalidations++;
+            }
+        }
+    }
+}
+
+void cache_find_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id) {
+    int k = required_id == -1 ? 0 : required_id == -3 ? 1 : -1;
+    if (k < 0 || slots_length < 1 || slots_length > ORD_MAX_LENGTH || slots_width < 1 || slots_width > ORD_MAX_WIDTH) {
+        ord_find_docking_spot(slots_length, slots_width, best_r, best_c, best_quay_distance, required_id);
+        return;
+    }
+    CacheEntry* e = &cache_entries[slots_length][slots_width][k];
+    // A spot can become unreachable (checked by can_dock_here) or a better one reachable (reach_gains)
+    if (e->valid && e->reach_gains == reach_gains &&
+        (e->r < 0 || can_dock_here(e->r, e->c, slots_length, slots_width, required_id))) {
+        cache_hits++;
+        *best_r = e->r;
+        *best_c = e->c;
+        *best_quay_distance = e->r >= 0 ? e->score : port_cols * SLOT_SIZE;
+        return;
+    }
+    cache_misses++;
+    ord_find_docking_spot(slots_length, slots_width, best_r, best_c, best_quay_distance, required_id);
+    e->valid = 1;
+    e->reach_gains = reach_gains;
+    e->r = *best_r;
+    e->c = *best_c;
+    e->score = *best_quay_distance;
+}
+
+void cache_report() {
+    printf("Search cache: %ld hits, %ld misses (%.1f%% hit rate), %ld invalidations\n",
+        cache_hits, cache_misses,
+        cache_hits + cache_misses ? 100.0 * cache_hits / (cache_hits + cache_misses) : 0.0,
+        cache_invalidations);
+}
+
+// Layout tiles: the port is divided into TILE_SIZE x TILE_SIZE tiles, and only
+// port_dockable percent of them (picked by a hash of their coordinates, so the
+// layout does not depend on the seed) have quays and berths. The others are open
+// water. Slots are stored by tile: port holds the slots of the populated tiles,
+// in row-major order of the tiles, and every tile of open water maps to a single
+// shared page of open water slots, which is never written since open water never
+// changes. A directory with an entry per tile finds both, so the grid takes
+// memory for the dockable area plus a few bytes per tile of open water, and
+// structures that only care about berths are sized and searched by the populated
+// tiles alone.
+PortTile* port_tiles;             // Populated tiles, row-major
+int port_tile_count;
+PortTile* port_open_tiles;        // Tiles of open water, row-major
+int port_open_count;
+int port_tile_rows, port_tile_cols;
+int* port_tile_dir;               // Index into port_tiles of every tile, -1 - index into port_open_tiles for open water
+PortSlot** port_pages;            // Slots of every tile: its page in port, or the open water page
+
+static inline size_t tile_hash(int tile_row, int tile_col) {
+    uint64_t key = ((uint64_t)(uint32_t)tile_row << 32) | (uint32_t)tile_col;
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+// Whether the tile has berths in the layout
+static int tile_dockable(int tile_row, int tile_col) {
+    return port_dockable >= 100 || (int)(tile_hash(tile_row, tile_col) % 100) < port_dockable;
+}
+
+// Index of the populated tile at the given tile coordinates, -1 for open water
+// or outside the port
+int tile_lookup(int tile_row, int tile_col) {
+    if (tile_row < 0 || tile_col < 0 || tile_row >= port_tile_rows || tile_col >= port_tile_cols)
+        return -1;
+    int t = port_tile_dir[tile_row * port_tile_cols + tile_col];
+    return t >= 0 ? t : -1;
+}
+
+// Tiles of the layout, populated and open water
+static void tiles_count(int* populated, int* open) {
+    int tile_rows = (port_rows + TILE_SIZE - 1) / TILE_SIZE, tile_cols = (port_cols + TILE_SIZE - 1) / TILE_SIZE;
+    *populated = 0;
+    for (int tr = 0; tr < tile_rows; tr++)
+        for (int tc = 0; tc < tile_cols; tc++)
+            *populated += tile_dockable(tr, tc);
+    *open = tile_rows * tile_cols - *populated;
+}
+
+// List the tiles of the layout, fill the directory and give every populated tile
+// its page of slots (slots past the edge of the port are land), -1 if out of memory
+static int tiles_init() {
+    port_tile_rows = (port_rows + TILE_SIZE - 1) / TILE_SIZE;
+    port_tile_cols = (port_cols + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_count(&port_tile_count, &port_open_count);
+    size_t tiles = (size_t)port_tile_rows * port_tile_cols, slots = (size_t)port_tile_count * TILE_CELLS;
+    port_tiles = (PortTile*)arena_alloc((port_tile_count + 1) * sizeof(PortTile));
+    port_open_tiles = (PortTile*)arena_alloc((port_open_count + 1) * sizeof(PortTile));
+    port_tile_dir = (int*)arena_alloc(tiles * sizeof(int));
+    port_pages = (PortSlot**)arena_alloc(tiles * sizeof(PortSlot*));
+    port = (PortSlot*)arena_alloc((slots + TILE_CELLS) * sizeof(PortSlot)); // The open water page last
+    if (!port_tiles || !port_open_tiles || !port_tile_dir || !port_pages || !port)
+        return -1;
+    int n = 0, m = 0;
+    for (int tr = 0; tr < port_tile_rows; tr++)
+        for (int tc = 0; tc < port_tile_cols; tc++) {
+            size_t i = (size_t)tr * port_tile_cols + tc;
+            if (tile_dockable(tr, tc)) {
+                port_tiles[n] = (PortTile){tr, tc, port_cols * SLOT_SIZE};
+                port_tile_dir[i] = n;
+                port_pages[i] = port + (size_t)n++ * TILE_CELLS;
+            } else {
+                port_open_tiles[m] = (PortTile){tr, tc, port_cols * SLOT_SIZE};
+                port_tile_dir[i] = -1 - m++;
+                port_pages[i] = port + slots;
+            }
+        }
+    for (size_t i = 0; i < slots + TILE_CELLS; i++) {
+        port[i].base = i < slots ? -2 : -5;
+        atomic_store(&port[i].occupied, port[i].base);
+        port[i].quay_distance = port_cols * SLOT_SIZE;
+    }
+    return 0;
+}
+
+// Smallest quay distance of a yacht starting in each populated tile
+static void tiles_init_quays() {
+    for (int n = 0; n < port_tile_count; n++) {
+        PortTile* t = &port_tiles[n];
+        // A yacht starting in the tile may reach into the next columns
+        for (int r = t->row * TILE_SIZE; r < (t->row + 1) * TILE_SIZE && r < port_rows; r++)
+            for (int c = t->col * TILE_SIZE; c < (t->col + 1) * TILE_SIZE + MAX_SLOTS_WIDTH - 1 && c < port_cols; c++)
+                if (CELL(r, c).quay_distance < t->min_quay_distance)
+                    t->min_quay_distance = CELL(r, c).quay_distance;
+    }
+}
+
+// Tiles backend: every populated tile keeps one bitmask per row and berth class
+// (bit j of row i set if slot (i, j) of the tile holds that class). A query ANDs
+// the masks of slots_length rows and shifts the result slots_width - 1 times,
+// borrowing the masks of the tiles below and to the right where a yacht crosses
+// a tile edge; the bits left are the positions where the yacht fits, and only
+// those are checked for reachability and scored. Open water has no masks and is
+// never visited, and tiles without a free slot of the class or farther from a
+// quay than the best spot so far are skipped, so the memory of the masks and the
+// search time grow with the dockable area of the port, not with its bounding box.
+_Static_assert(MAX_SLOTS_LENGTH < TILE_SIZE && MAX_SLOTS_WIDTH < TILE_SIZE, "a yacht crosses at most one tile edge per axis");
+
+typedef struct {
+    uint64_t rows[2][TILE_SIZE];  // Berth masks per class (0 = free, 1 = oil pump) and row
+    int count[2];                 // Slots of each class in the tile
+    int right, below, below_right; // Neighbouring populated tiles, -1 for open water or the edge
+} TileMasks;
+
+TileMasks* tile_masks;            // By index into port_tiles
+long tile_searches, tile_visits;
+
+// Recompute the mask bits of the slots in a rectangle
+void tiles_update(int r, int c, int slots_length, int slots_width) {
+    for (int i = r; i < r + slots_length; i++)
+        for (int j = c; j < c + slots_width; j++) {
+            int t = tile_lookup(i >> TILE_BITS, j >> TILE_BITS);
+            if (t < 0)
+                continue;
+            int k = berth_class(atomic_load(&CELL(i, j).occupied));
+            uint64_t bit = 1ULL << (j & (TILE_SIZE - 1));
+            uint64_t* rows = &tile_masks[t].rows[0][i & (TILE_SIZE - 1)];
+            for (int m = 0; m < 2; m++) {
+                uint64_t* row = rows + m * TILE_SIZE;
+                int had = (*row & bit) != 0, has = k == m;
+                if (had != has) {
+                    *row ^= bit;
+                    tile_masks[t].count[m] += has - had;
+                }
+            }
+        }
+}
+
+int tiles_init_masks() {
+    tile_masks = (TileMasks*)arena_alloc((port_tile_count + 1) * sizeof(TileMasks));
+    if (!tile_masks)
+        return -1;
+    memset(tile_masks, 0, (port_tile_count + 1) * sizeof(TileMasks));
+    for (int t = 0; t < port_tile_count; t++) {
+        const PortTile* tile = &port_tiles[t];
+        tile_masks[t].right = tile_lookup(tile->row, tile->col + 1);
+        tile_masks[t].below = tile_lookup(tile->row + 1, tile->col);
+        tile_masks[t].below_right = tile_lookup(tile->row + 1, tile->col + 1);
+        int r = tile->row * TILE_SIZE, c = tile->col * TILE_SIZE;
+        tiles_update(r, c, r + TILE_SIZE <= port_rows ? TILE_SIZE : port_rows - r,
+            c + TILE_SIZE <= port_cols ? TILE_SIZE : port_cols - c);
+    }
+    tile_searches = tile_visits = 0;
+    return 0;
+}
+
+// Mask row 'i' (which may run into the tile below) of class k of tile t and of its right neighbour
+static inline void tiles_row(const TileMasks* m, int i, int k, uint64_t* lo, uint64_t* hi) {
+    if (i >= TILE_SIZE) {
+        i -= TILE_SIZE;
+        *lo = m->below >= 0 ? tile_masks[m->below].rows[k][i] : 0;
+        *hi = m->below_right >= 0 ? tile_masks[m->below_right].rows[k][i] : 0;
+    } else {
+        *lo = m->rows[k][i];
+        *hi = m->right >= 0 ? tile_masks[m->right].rows[k][i] : 0;
+    }
+}
+
+// Offer every position of mask row i of tile t where the yacht fits. Tiles are
+// not visited in the scan order, so ties go to the first slot in row-major order.
+static void tiles_offer_row(int t, int i, int slots_length, int slots_width, int k, int* best_r, int* best_c, int* best_quay_distance) {
+    const TileMasks* m = &tile_masks[t];
+    uint64_t lo = ~0ULL, hi = ~0ULL;
+    for (int d = 0; d < slots_length && lo; d++) {
+        uint64_t row_lo, row_hi;
+        tiles_row(m, i + d, k, &row_lo, &row_hi);
+        lo &= row_lo;
+        hi &= row_hi;
+    }
+    uint64_t fit = lo;
+    for (int s = 1; s < slots_width && fit; s++)
+        fit &= (lo >> s) | (hi << (TILE_SIZE - s));
+    for (; fit; fit &= fit - 1) {
+        int r = port_tiles[t].row * TILE_SIZE + i, c = port_tiles[t].col * TILE_SIZE + __builtin_ctzll(fit);
+        if (!berth_reachable(r, c))
+            continue;
+        int distance = quay_score(r, c, slots_width);
+        if (distance < *best_quay_distance ||
+            (distance == *best_quay_distance && *best_r >= 0 && (r < *best_r || (r == *best_r && c < *best_c)))) {
+            *best_quay_distance = distance;
+            *best_r = r;
+            *best_c = c;
+        }
+    }
+}
+
+void tiles_find_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id) {
+    *best_r = -1;
+    *best_c = -1;
+    *best_quay_distance = port_cols * SLOT_SIZE;
+    int k = berth_class(required_id);
+    if (k < 0 || slots_length < 1 || slots_width < 1)
+        return;
+    tile_searches++;
+    for (int t = 0; t < port_tile_count; t++) {
+        const PortTile* tile = &port_tiles[t];
+        if (tile_masks[t].count[k] == 0 || tile->min_quay_distance > *best_quay_distance)
+            continue;
+        tile_visits++;
+        for (int i = 0; i < TILE_SIZE && tile->row * TILE_SIZE + i + slots_length <= port_rows; i++)
+            tiles_offer_row(t, i, slots_length, slots_width, k, best_r, best_c, best_quay_distance);
+    }
+}
+
+void tiles_report() {
+    int tile_rows = (port_rows + TILE_SIZE - 1) / TILE_SIZE, tile_cols = (port_cols + TILE_SIZE - 1) / TILE_SIZE;
+    printf("Tiles: %d of %d populated, %.1f MB of masks, %.1f tiles visited per search\n",
+        port_tile_count, tile_rows * tile_cols, port_tile_count * sizeof(TileMasks) / 1e6,
+        tile_searches ? (double)tile_visits / tile_searches : 0.0);
+}
+
+// Anytime backend: the tiles of the 'tiles' backend are visited best first, in
+// ascending order of the smallest quay distance a yacht starting in them can
+// have. That distance is a lower bound for every spot in the tiles not visited
+// yet, so the search stops as soon as the next bound exceeds the best spot found
+// (the spot is then the exact answer), or when the budget of slot positions
+// (search_budget_cells) or wall time (search_budget_us) is spent. A search cut
+// short returns the best spot found so far, or none, and its spot is at most
+// (its quay distance - the bound of the next tile) away from the optimum. The
+// budget is checked before every mask row of a tile, so a search examines at
+// most one row (TILE_SIZE positions) more than its budget. This keeps the time
+// port_mutex is held per docking bounded on huge grids.
+// Every footprint class first visits a hint tile, the tile of its last spot. A
+// search that runs out of budget without a spot leaves the rank and row it
+// stopped at and drops the hint, and the next search of the class goes on from
+// there (wrapping around), so a yacht that retries covers the port over its
+// retries instead of failing on the same rows again.
+long search_budget_cells;         // Slot positions examined per search, 0 for no limit
+long search_budget_us;            // Wall time per search, 0 for no limit
+int* anytime_order;               // Populated tiles by ascending lower bound
+int* anytime_stamp;               // Search that last visited a tile
+int anytime_epoch;
+typedef struct {
+    int hint;                     // Tile visited first, -1 for none
+    int resume;                   // Rank in anytime_order the search starts at
+    int resume_row;               // Mask row of that tile the search starts at
+} AnytimeClass;
+AnytimeClass anytime_classes[ORD_MAX_LENGTH + 1][ORD_MAX_WIDTH + 1][2];
+long anytime_searches, anytime_cut_short, anytime_gave_up;
+long anytime_gap_total, anytime_gap_max; // Distance from the optimum bound of the spots of searches cut short
+long anytime_cells_max;           // Most positions examined by one search
+double anytime_us_max;            // Longest search
+
+static int anytime_compare(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    int dx = port_tiles[x].min_quay_distance, dy = port_tiles[y].min_quay_distance;
+    return dx != dy ? (dx < dy ? -1 : 1) : x - y;
+}
+
+int anytime_init() {
+    if (tiles_init_masks() < 0)
+        return -1;
+    anytime_order = (int*)arena_alloc((port_tile_count + 1) * sizeof(int));
+    anytime_stamp = (int*)arena_alloc((port_tile_count + 1) * sizeof(int));
+    if (!anytime_order || !anytime_stamp)
+        return -1;
+    for (int t = 0; t < port_tile_count; t++) {
+        anytime_order[t] = t;
+        anytime_stamp[t] = 0;
+    }
+    qsort(anytime_order, port_tile_count, sizeof(int), anytime_compare);
+    anytime_epoch = 0;
+    for (int l = 0; l <= ORD_MAX_LENGTH; l++)
+        for (int w = 0; w <= ORD_MAX_WIDTH; w++)
+            for (int k = 0; k < 2; k++)
+                anytime_classes[l][w][k] = (AnytimeClass){-1, 0, 0};
+    anytime_searches = anytime_cut_short = anytime_gave_up = 0;
+    anytime_gap_total = anytime_gap_max = anytime_cells_max = 0;
+    anytime_us_max = 0;
+    return 0;
+}
+
+// Whether the budget of a search that started at 'start' and examined 'cells' positions is spent
+static int anytime_spent(const struct timespec* start, long cells) {
+    if (search_budget_cells > 0 && cells >= search_budget_cells)
+        return 1;
+    if (search_budget_us > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3 >= search_budget_us;
+    }
+    return 0;
+}
+
+// Offer the positions of tile t in mask rows [*row, end), checking the budget
+// before every row. Returns 1 once the rows are done, 0 if the budget ran out
+// first, with *row the row to go on from. The caller stamps the tile once all of
+// its rows were visited.
+static int anytime_visit(int t, int* row, int end, int slots_length, int slots_width, int k, int* best_r, int* best_c, int* best_quay_distance,
+    const struct timespec* start, long* cells) {
+    for (; *row < end && port_tiles[t].row * TILE_SIZE + *row + slots_length <= port_rows; (*row)++) {
+        if (anytime_spent(start, *cells))
+            return 0;
+        tiles_offer_row(t, *row, slots_length, slots_width, k, best_r, best_c, best_quay_distance);
+        *cells += TILE_SIZE;
+    }
+    return 1;
+}
+
+void anytime_find_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id) {
+    *best_r = -1;
+    *best_c = -1;
+    *best_quay_distance = port_cols * SLOT_SIZE;
+    int k = berth_class(required_id);
+    if (k < 0 || slots_length < 1 || slots_length > ORD_MAX_LENGTH || slots_width < 1 || slots_width > ORD_MAX_WIDTH)
+        return;
+    AnytimeClass* cls = &anytime_classes[slots_length][slots_width][k];
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long cells = 0;
+    int done = 1, row = 0, stop = -1;
+    anytime_searches++;
+    anytime_epoch++;
+    if (cls->hint >= 0 && tile_masks[cls->hint].count[k] > 0) {
+        done = anytime_visit(cls->hint, &row, TILE_SIZE, slots_length, slots_width, k, best_r, best_c, best_quay_distance, &start, &cells);
+        if (done)
+            anytime_stamp[cls->hint] = anytime_epoch;
+    }
+
+    // Ranks [first, count) and then [0, first), each in ascending lower bound.
+    // The first tile is visited from the row the last search stopped at, so it
+    // stays unstamped and comes again at the end for the rows before that
+    int first = cls->resume < port_tile_count ? cls->resume : 0;
+    int first_row = first == cls->resume ? cls->resume_row : 0;
+    for (int step = 0; done && port_tile_count > 0 && step <= port_tile_count; step++) {
+        int n = (first + step) % port_tile_count;
+        int t = anytime_order[n];
+        if (port_tiles[t].min_quay_distance > *best_quay_distance) {
+            // Every spot left in this run of ranks is farther from a quay
+            if (n < first || step == port_tile_count)
+                break;
+            step = port_tile_count - first - 1;
+            continue;
+        }
+        if (anytime_stamp[t] == anytime_epoch || tile_masks[t].count[k] == 0)
+            continue;
+        int end = TILE_SIZE;
+        row = 0;
+        if (step == 0)
+            row = first_row;
+        else if (step == port_tile_count)
+            end = first_row; // Only the rows skipped at step 0 are left
+        done = anytime_visit(t, &row, end, slots_length, slots_width, k, best_r, best_c, best_quay_distance, &start, &cells);
+        if (!done)
+            stop = n;
+        else if (step > 0 || first_row == 0)
+            anytime_stamp[t] = anytime_epoch;
+    }
+
+    // Cut short if a tile that could hold a spot as good was left (partly)
+    // unvisited; the first such tile in rank order has the smallest bound
+    int bound = -1;
+    for (int i = 0; i < port_tile_count && bound < 0; i++) {
+        int t = anytime_order[i];
+        if (port_tiles[t].min_quay_distance > *best_quay_distance)
+            break;
+        if (anytime_stamp[t] != anytime_epoch && tile_masks[t].count[k] > 0)
+            bound = port_tiles[t].min_quay_distance;
+    }
+    if (bound >= 0) {
+        anytime_cut_short++;
+        if (*best_r < 0) {
+            anytime_gave_up++;
+            cls->hint = -1; // Go on from where the budget ran out next time
+            if (stop >= 0) {
+                cls->resume = stop;
+                cls->resume_row = row;
+            }
+        } else {
+            long gap = *best_quay_distance - bound;
+            anytime_gap_total += gap;
+            if (gap > anytime_gap_max)
+                anytime_gap_max = gap;
+        }
+    }
+    if (*best_r >= 0) {
+        cls->hint = tile_lookup(*best_r >> TILE_BITS, *best_c >> TILE_BITS);
+        cls->resume = cls->resume_row = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double us = (now.tv_sec - start.tv_sec) * 1e6 + (now.tv_nsec - start.tv_nsec) / 1e3;
+    if (cells > anytime_cells_max)
+        anytime_cells_max = cells;
+    if (us > anytime_us_max)
+        anytime_us_max = us;
+}
+
+void anytime_report() {
+    long found = anytime_cut_short - anytime_gave_up;
+    printf("Anytime search: %ld searches, %ld cut short by the budget (%ld without a spot), spots of those within %.1f (at most %ld) quay distance of the optimum, longest search %ld positions / %.1f us\n",
+        anytime_searches, anytime_cut_short, anytime_gave_up,
+        found ? (double)anytime_gap_total / found : 0.0, anytime_gap_max, anytime_cells_max, anytime_us_max);
+}
+
+// Available docking search backends
+DockAllocator allocators[] = {
+    {"scan", NULL, NULL, scan_find_docking_spot, NULL, scan_find_multi},
+    {"hist", hist_init, hist_update, hist_find_docking_spot, NULL, hist_find_multi},
+    {"pyramid", pyr_init, pyr_update, pyr_find_docking_spot, NULL, pyr_find_multi},
+    {"ordered", ord_init, NULL, ord_find_docking_spot, NULL, NULL},
+    {"cached", cache_init, cache_update, cache_find_docking_spot, cache_report, NULL},
+    {"tiles", tiles_init_masks, tiles_update, tiles_find_docking_spot, tiles_report, NULL},
+    {"anytime", anytime_init, tiles_update, anytime_find_docking_spot, anytime_report, NULL},
+};
+DockAllocator* allocator = &allocators[0];
+
+// Select a docking search backend by name, returns 0 if it does not exist
+int select_allocator(const char* name) {
+    for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+        if (strcmp(allocators[i].name, name) == 0) {
+            allocator = &allocators[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Thread roles: every thread of a run belongs to a role (PORT_SIM_*) that can be
+// pinned to a CPU set, to keep the engine apart from the workers and the output
+// thread. Threads of a role without a set run on the CPUs the process had when
+// the run was created, so pinning the engine does not pull the threads it starts
+// onto its own CPUs. The CPU time of every role is reported in the summary.
+typedef struct {
+    int pinned;                   // A CPU set was given
+    cpu_set_t cpus;
+    char list[64];                // The set as given, for the summary
+    int threads;                  // Threads that have run in the role
+    atomic_long exited_ns;        // CPU time of the threads that have exited
+} ThreadRole;
+static ThreadRole thread_roles[PORT_SIM_ROLES];
+const char* const role_names[PORT_SIM_ROLES] = {"engine", "speculate", "lookahead", "output"};
+static cpu_set_t process_cpus;         // CPUs of the process when the run was created
+static int roles_pinned;          // Whether any role is pinned
+static pthread_t engine_thread;   // Thread running the engine
+
+// Parse a CPU list such as "0-3,6" into 'set', returns 0 if it is not valid
+static int cpu_list_parse(const char* list, cpu_set_t* set) {
+    CPU_ZERO(set);
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p || lo < 0)
+            return 0;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo)
+                return 0;
+        }
+        if (hi >= CPU_SETSIZE)
+            return 0;
+        for (long cpu = lo; cpu <= hi; cpu++)
+            CPU_SET(cpu, set);
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return 0;
+        p = end;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+// Set up the roles of a run from the CPU lists of 'config' and pin the calling
+// (engine) thread. Returns 0 and reports the role if a list has no usable CPU.
+static int roles_init(const PortSimConfig* config) {
+    memset(thread_roles, 0, sizeof(thread_roles));
+    roles_pinned = 0;
+    engine_thread = pthread_self();
+    sched_getaffinity(0, sizeof(process_cpus), &process_cpus);
+    for (int i = 0; i < PORT_SIM_ROLES; i++) {
+        ThreadRole* role = &thread_roles[i];
+        if (!config->cpus[i])
+            continue;
+        cpu_set_t usable;
+        if (!cpu_list_parse(config->cpus[i], &role->cpus) ||
+            (CPU_AND(&usable, &role->cpus, &process_cpus), CPU_COUNT(&usable) == 0)) {
+            fprintf(stderr, "No usable CPU in '%s' for the %s role\n", config->cpus[i], role_names[i]);
+            return 0;
+        }
+        role->pinned = 1;
+        snprintf(role->list, sizeof(role->list), "%s", config->cpus[i]);
+        roles_pinned = 1;
+    }
+    thread_roles[PORT_SIM_ENGINE].threads = 1;
+    if (thread_roles[PORT_SIM_ENGINE].pinned)
+        pthread_setaffinity_np(engine_thread, sizeof(cpu_set_t), &thread_roles[PORT_SIM_ENGINE].cpus);
+    return 1;
+}
+
+// Give the engine thread back the CPUs of the process
+static void roles_release() {
+    if (thread_roles[PORT_SIM_ENGINE].pinned)
+        pthread_setaffinity_np(engine_thread, sizeof(cpu_set_t), &process_cpus);
+    thread_roles[PORT_SIM_ENGINE].pinned = 0;
+}
+
+// Called first by every thread the engine starts
+static void role_enter(int role) {
+    ThreadRole* r = &thread_roles[role];
+    if (r->pinned)
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &r->cpus);
+    else if (roles_pinned)
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &process_cpus);
+}
+
+// Called last by every thread the engine starts
+static void role_leave(int role) {
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    atomic_fetch_add(&thread_roles[role].exited_ns, t.tv_sec * 1000000000L + t.tv_nsec);
+}
+
+// CPU time of a running thread, 0 if it cannot be read
+static double thread_cpu_seconds(pthread_t thread) {
+    clockid_t clock;
+    struct timespec t;
+    if (pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &t) != 0)
+        return 0;
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Speculative search: while yachts wait, worker threads precompute the best spot
+// of every footprint class that has a waiting yacht. Grid writes bump
+// grid_generation to an odd value before and an even value after (a seqlock), so
+// a worker knows its lock-free search saw a consistent grid, and the engine only
+// uses a precomputed spot whose generation is still current. Workers use the
+// read-only 'ordered' search, which returns the same spot as every backend.
+typedef struct {
+    unsigned long generation;     // Grid generation the spot was computed for, 0 if none
+    int r, c;                     // Best spot, -1 if the class does not fit anywhere
+    int score;                    // Quay distance of the spot
+    int busy;                     // A worker is computing this entry
+} SpecEntry;
+
+typedef struct {
+    int threads;                  // Number of worker threads, 0 if speculation is off
+    int stop;                     // Set to make the workers exit
+    pthread_t* tids;
+    pthread_mutex_t mutex;        // Guards everything below
+    pthread_cond_t cond;          // Signalled when the grid or the wanted classes change
+    int wanted[ORD_MAX_LENGTH + 1][ORD_MAX_WIDTH + 1][2]; // Waiting yachts per footprint class
+    SpecEntry entries[ORD_MAX_LENGTH + 1][ORD_MAX_WIDTH + 1][2];
+    long hits;                    // Searches answered by a precomputed spot
+    long misses;                  // Searches done on the critical path
+} Speculator;
+Speculator spec;
+_Alignas(CACHE_LINE) atomic_ulong grid_generation = 2;
+
+// Pick a wanted footprint class whose entry is stale, returns 0 if there is none
+static int spec_pick(unsigned long generation, int* l, int* w, int* k) {
+    for (int i = 1; i <= ORD_MAX_LENGTH; i++)
+        for (int j = 1; j <= ORD_MAX_WIDTH; j++)
+            for (int m = 0; m < 2; m++) {
+                SpecEntry* e = &spec.entries[i][j][m];
+                if (spec.wanted[i][j][m] > 0 && !e->busy && e->generation != generation) {
+                    *l = i; *w = j; *k = m;
+                    return 1;
+                }
+            }
+    return 0;
+}
+
+static void* spec_thread(void* arg) {
+    (void)arg;
+    role_enter(PORT_SIM_SPECULATE);
+    pthread_mutex_lock(&spec.mutex);
+    while (!spec.stop) {
+        int l, w, k;
+        unsigned long before = atomic_load(&grid_generation);
+        if ((before & 1) || !spec_pick(before, &l, &w, &k)) {
+            pthread_cond_wait(&spec.cond, &spec.mutex);
+            continue;
+        }
+        spec.entries[l][w][k].busy = 1;
+        pthread_mutex_unlock(&spec.mutex);
+
+        int r, c, score;
+        ord_find_docking_spot(l, w, &r, &c, &score, k == 0 ? -1 : -3);
+        unsigned long after = atomic_load(&grid_generation);
+
+        pthread_mutex_lock(&spec.mutex);
+        SpecEntry* e = &spec.entries[l][w][k];
+        e->busy = 0;
+        if (before == after) {
+            e->generation = before;
+            e->r = r;
+            e->c = c;
+            e->score = score;
+        }
+    }
+    pthread_mutex_unlock(&spec.mutex);
+    role_leave(PORT_SIM_SPECULATE);
+    return NULL;
+}
+
+// Start 'threads' speculative search workers
+void spec_start(int threads) {
+    memset(&spec, 0, sizeof(spec));
+    if (threads <= 0)
+        return;
+    if (allocator->find != ord_find_docking_spot && allocator->find != cache_find_docking_spot)
+        ord_init(); // Workers need the candidate lists even if another backend is selected
+    pthread_mutex_init(&spec.mutex, NULL);
+    pthread_cond_init(&spec.cond, NULL);
+    spec.threads = threads;
+    spec.tids = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    for (int i = 0; i < threads; i++)
+        pthread_create(&spec.tids[i], NULL, spec_thread, NULL);
+    thread_roles[PORT_SIM_SPECULATE].threads += threads;
+}
+
+// Stop and join the workers
+void spec_stop() {
+    if (!spec.threads)
+        return;
+    pthread_mutex_lock(&spec.mutex);
+    spec.stop = 1;
+    pthread_cond_broadcast(&spec.cond);
+    pthread_mutex_unlock(&spec.mutex);
+    for (int i = 0; i < spec.threads; i++)
+        pthread_join(spec.tids[i], NULL);
+    free(spec.tids);
+    spec.threads = 0;
+}
+
+// Count a waiting yacht under the berth classes its next docking attempt needs
+void spec_want(Yacht* yacht, int waiting) {
+    if (!spec.threads)
+        return;
+    int l = ceil((double)yacht->length / SLOT_SIZE), w = ceil((double)yacht->width / SLOT_SIZE);
+    int classes = 0;
+    if (waiting)
+        classes = yacht->oil_level < 50 ? 2 : yacht->waiting_time >= 15 ? 3 : 1;
+    if (classes == yacht->spec_classes || l > ORD_MAX_LENGTH || w > ORD_MAX_WIDTH)
+        return;
+    pthread_mutex_lock(&spec.mutex);
+    for (int k = 0; k < 2; k++)
+        spec.wanted[l][w][k] += ((classes >> k) & 1) - ((yacht->spec_classes >> k) & 1);
+    yacht->spec_classes = classes;
+    pthread_cond_broadcast(&spec.cond);
+    pthread_mutex_unlock(&spec.mutex);
+}
+
+// Take a precomputed spot if it was computed for the current grid
+static int spec_lookup(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id) {
+    int k = required_id == -1 ? 0 : required_id == -3 ? 1 : -1;
+    if (k < 0 || slots_length > ORD_MAX_LENGTH || slots_width > ORD_MAX_WIDTH)
+        return 0;
+    unsigned long generation = atomic_load(&grid_generation);
+    pthread_mutex_lock(&spec.mutex);
+    SpecEntry* e = &spec.entries[slots_length][slots_width][k];
+    int hit = e->generation == generation;
+    if (hit) {
+        *best_r = e->r;
+        *best_c = e->c;
+        *best_quay_distance = e->r >= 0 ? e->score : port_cols * SLOT_SIZE;
+        spec.hits++;
+    } else {
+        spec.misses++;
+    }
+    pthread_mutex_unlock(&spec.mutex);
+    return hit;
+}
+
+// Look-ahead placement (--lookahead K): a docking yacht does not simply take the
+// berth closest to a quay, but weighs the K best berths in that order by playing
+// short Monte Carlo rollouts of the next LOOKAHEAD_HORIZON seconds from each. A
+// rollout runs on a private copy of the grid: docked yachts leave after a sampled
+// stay, the yachts of the waiting queue and random new arrivals dock greedily,
+// and the cost is the time they all wait. Rollout i draws the same random future
+// for every candidate, so candidates are compared on equal terms, and the lowest
+// mean cost wins (ties go to the greedy order). Rollouts run on a worker pool,
+// helped by the engine thread, until the time budget of the decision is spent.
+// Rollouts ignore manoeuvres and reachability; only the candidates are checked.
+#define LOOKAHEAD_MAX 16              // Most candidate berths per decision
+#define LOOKAHEAD_ROLLOUTS 8          // Rollouts per candidate
+#define LOOKAHEAD_HORIZON 120         // Simulated seconds per rollout
+#define LOOKAHEAD_MAX_STAY 40         // Docked yachts leave within this many seconds
+#define LOOKAHEAD_MAX_WAITING (MAX_QUEUE + LOOKAHEAD_HORIZON / ARRIVAL_INTERVAL + 1)
+
+typedef struct {
+    int r, c, l, w;
+    int leave;                        // Second of the rollout at which the yacht leaves
+} RollBerth;
+
+typedef struct {
+    int l, w;                         // Footprint in slots, l == 0 once docked
+    int fuel;                         // Needs an oil pump berth
+    int arrive;                       // Second it joined the queue (negative if before the rollout)
+    int stay;                         // Seconds it stays once docked
+} RollYacht;
+
+typedef struct {
+    int* grid;                        // Private copy of the grid
+    RollBerth* berths;
+    RollYacht waiting[LOOKAHEAD_MAX_WAITING];
+} RollBuffers;
+
+typedef struct {
+    int candidates;                   // K, 0 if look-ahead placement is off
+    int threads;                      // Worker threads besides the engine thread
+    int budget_ms;                    // Wall time per decision, 0 for no limit
+    pthread_t* tids;
+    RollBuffers* buffers;             // One per worker, the last one for the engine thread
+    pthread_mutex_t mutex;            // Guards the task counters and results
+    pthread_cond_t cond;              // Signalled when a decision has tasks
+    pthread_cond_t done;              // Signalled when the last running rollout ends
+    int stop;
+    // Snapshot of the decision, read-only while its rollouts run
+    int* grid;
+    RollBerth* docked;
+    int docked_count;
+    RollYacht queued[MAX_QUEUE + 1];  // Waiting queue, then the docking yacht
+    int queued_count;
+    DockSpot cands[LOOKAHEAD_MAX];
+    int cand_count;
+    uint64_t seed;
+    struct timespec deadline;
+    int next_task, total, running;    // Task t is rollout t / cand_count of candidate t % cand_count
+    long cost[LOOKAHEAD_MAX];
+    int runs[LOOKAHEAD_MAX];
+    long decisions;                   // Decisions with more than one candidate
+    long moved;                       // Decisions that did not take the greedy berth
+    long rollouts;
+    long cut_short;                   // Decisions stopped by the time budget
+    double wall_ms;                   // Wall time spent deciding
+} Lookahead;
+Lookahead lookahead;
+
+// xorshift64* step on a private state
+static inline uint32_t rng_next(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (uint32_t)((*state * 0x2545F4914F6CDD1DULL) >> 33);
+}
+
+// Rollout yacht with the given size and needs, its stay drawn from 'rng'
+static RollYacht roll_yacht(uint64_t* rng, int length, int width, int oil, int services, int arrive) {
+    RollYacht y = {(int)ceil((double)length / SLOT_SIZE), (int)ceil((double)width / SLOT_SIZE), oil < 50, arrive, 0};
+    if (y.fuel)
+        y.stay = (100 - oil) * REFUEL_STEP_MS / 1000 + 1;
+    else
+        y.stay = rng_next(rng) % 20 + 20 + services * (CREW_JOB_TIME + 5);
+    return y;
+}
+
+// Whether a random draw falls in the first 'pct' percent. The percentile takes
+// the last digit of the draw as its tens, so 10% picks the draws ending in 0.
+static inline int draw_percent(uint32_t x, int pct) {
+    return (int)(x % 10 * 10 + x / 10 % 10) < pct;
+}
+
+// Random new arrival, drawn like the engine draws them
+static RollYacht roll_arrival(uint64_t* rng, int arrive) {
+    int length = rng_next(rng) % (YACHT_MAX_LENGTH - YACHT_MIN_LENGTH + 1) + YACHT_MIN_LENGTH;
+    int width = rng_next(rng) % (YACHT_MAX_WIDTH - YACHT_MIN_WIDTH + 1) + YACHT_MIN_WIDTH;
+    int oil = rng_next(rng) % 99 + 1;
+    int services = draw_percent(rng_next(rng), engine.demand[0]);
+    services += draw_percent(rng_next(rng), engine.demand[1]);
+    return roll_yacht(rng, length, width, oil, services, arrive + rng_next(rng) % 3 + 1);
+}
+
+// Value of slot (r, c) on a rollout grid, which has the slots of port
+static inline int roll_at(const int* grid, int r, int c) {
+    long idx = slot_index(r, c);
+    return idx < 0 ? -5 : grid[idx];
+}
+
+// Write 'value' into a rectangle of a rollout grid, or the layout value if it is 0
+static void roll_fill(int* grid, int r, int c, int l, int w, int value) {
+    for (int i = r; i < r + l; i++)
+        for (int j = c; j < c + w; j++) {
+            long idx = slot_index(i, j);
+            grid[idx] = value ? value : port[idx].keep_clear ? -4 : port[idx].base;
+        }
+}
+
+// Greedy spot of berth class k (0 free, 1 oil pump) on a rollout grid, returns 0 if there is none
+static int roll_find(const int* grid, int l, int w, int k, int* best_r, int* best_c) {
+    int value = k == 0 ? -1 : -3;
+    const uint32_t* cand = ord_cands[w][k];
+    for (long i = 0; i < ord_count[w][k]; i++) {
+        int r = cand[i] / port_cols, c = cand[i] % port_cols, fits = r + l <= port_rows;
+        for (int a = 0; a < l && fits; a++)
+            for (int b = 0; b < w && fits; b++)
+                fits = roll_at(grid, r + a, c + b) == value;
+        if (fits) {
+            *best_r = r;
+            *best_c = c;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Play rollout 'index' with the docking yacht at candidate 'cand', returns the
+// seconds waited within the horizon
+static long lookahead_rollout(RollBuffers* b, int cand, int index) {
+    Lookahead* la = &lookahead;
+    uint64_t rng = la->seed + (uint64_t)(index + 1) * 0x9E3779B97F4A7C15ULL;
+    memcpy(b->grid, la->grid, (size_t)port_tile_count * TILE_CELLS * sizeof(int));
+    int nb = 0, nw = 0;
+    for (int i = 0; i < la->docked_count; i++) {
+        b->berths[nb] = la->docked[i];
+        b->berths[nb++].leave = rng_next(&rng) % LOOKAHEAD_MAX_STAY + 1;
+    }
+    const RollYacht* self = &la->queued[la->queued_count];
+    const DockSpot* spot = &la->cands[cand];
+    roll_fill(b->grid, spot->r, spot->c, self->l, self->w, 1);
+    b->berths[nb++] = (RollBerth){spot->r, spot->c, self->l, self->w, self->stay};
+    for (int i = 0; i < la->queued_count; i++)
+        b->waiting[nw++] = la->queued[i];
+    for (int t = 0; t + ARRIVAL_INTERVAL < LOOKAHEAD_HORIZON; t += ARRIVAL_INTERVAL)
+        b->waiting[nw++] = roll_arrival(&rng, t);
+
+    long cost = 0;
+    for (int t = 0; t < LOOKAHEAD_HORIZON; t++) {
+        for (int i = 0; i < nb; ) {
+            if (b->berths[i].leave <= t) {
+                RollBerth* g = &b->berths[i];
+                roll_fill(b->grid, g->r, g->c, g->l, g->w, 0);
+                *g = b->berths[--nb];
+            } else {
+                i++;
+            }
+        }
+        // One greedy matching pass; a yacht at least as large as one that found
+        // no berth of the same class is not searched for (see engine_dock)
+        int fail[2][MAX_SLOTS_LENGTH + 1];
+        for (int k = 0; k < 2; k++)
+            for (int l = 0; l <= MAX_SLOTS_LENGTH; l++)
+                fail[k][l] = INT_MAX;
+        for (int i = 0; i < nw; i++) {
+            RollYacht* y = &b->waiting[i];
+            if (y->l == 0 || y->arrive > t)
+                continue;
+            int classes = y->fuel ? 2 : t - y->arrive >= 15 ? 3 : 1;
+            for (int k = 0; k < 2; k++) {
+                if (!((classes >> k) & 1))
+                    continue;
+                int skip = 0;
+                for (int l = 1; l <= y->l && !skip; l++)
+                    skip = fail[k][l] <= y->w;
+                int r, c;
+                if (!skip && roll_find(b->grid, y->l, y->w, k, &r, &c)) {
+                    roll_fill(b->grid, r, c, y->l, y->w, 1);
+                    b->berths[nb++] = (RollBerth){r, c, y->l, y->w, t + y->stay};
+                    cost += t - y->arrive;
+                    y->l = 0;
+                    break;
+                }
+                if (!skip && y->w < fail[k][y->l])
+                    fail[k][y->l] = y->w;
+            }
+        }
+    }
+    for (int i = 0; i < nw; i++)
+        if (b->waiting[i].l && b->waiting[i].arrive < LOOKAHEAD_HORIZON)
+            cost += LOOKAHEAD_HORIZON - b->waiting[i].arrive;
+    return cost;
+}
+
+// Run rollouts of the current decision until none is left or the budget is
+// spent. The caller holds lookahead.mutex.
+static void lookahead_work(RollBuffers* b) {
+    Lookahead* la = &lookahead;
+    while (la->next_task < la->total) {
+        if (la->budget_ms > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec > la->deadline.tv_sec || (now.tv_sec == la->deadline.tv_sec && now.tv_nsec >= la->deadline.tv_nsec)) {
+                la->total = la->next_task;
+                la->cut_short++;
+                break;
+            }
+        }
+        int task = la->next_task++;
+        la->running++;
+        pthread_mutex_unlock(&la->mutex);
+        long cost = lookahead_rollout(b, task % la->cand_count, task / la->cand_count);
+        pthread_mutex_lock(&la->mutex);
+        la->cost[task % la->cand_count] += cost;
+        la->runs[task % la->cand_count]++;
+        la->rollouts++;
+        la->running--;
+    }
+    if (la->running == 0)
+        pthread_cond_broadcast(&la->done);
+}
+
+static void* lookahead_thread(void* arg) {
+    RollBuffers* b = (RollBuffers*)arg;
+    role_enter(PORT_SIM_LOOKAHEAD);
+    pthread_mutex_lock(&lookahead.mutex);
+    while (!lookahead.stop) {
+        if (lookahead.next_task >= lookahead.total) {
+            pthread_cond_wait(&lookahead.cond, &lookahead.mutex);
+            continue;
+        }
+        lookahead_work(b);
+    }
+    pthread_mutex_unlock(&lookahead.mutex);
+    role_leave(PORT_SIM_LOOKAHEAD);
+    return NULL;
+}
+
+// Enable look-ahead placement over 'candidates' berths with 'threads' workers
+void lookahead_start(int candidates, int threads, int budget_ms) {
+    memset(&lookahead, 0, sizeof(lookahead));
+    if (candidates < 2)
+        return;
+    if (allocator->find != ord_find_docking_spot && allocator->find != cache_find_docking_spot && !spec.threads)
+        ord_init(); // Candidates and rollouts use the candidate lists
+    size_t cells = (size_t)port_tile_count * TILE_CELLS;
+    lookahead.candidates = candidates < LOOKAHEAD_MAX ? candidates : LOOKAHEAD_MAX;
+    lookahead.threads = threads > 0 ? threads : 0;
+    lookahead.budget_ms = budget_ms;
+    lookahead.grid = (int*)malloc(cells * sizeof(int));
+    lookahead.docked = (RollBerth*)malloc(cells * sizeof(RollBerth));
+    lookahead.buffers = (RollBuffers*)calloc(lookahead.threads + 1, sizeof(RollBuffers));
+    for (int i = 0; i <= lookahead.threads; i++) {
+        lookahead.buffers[i].grid = (int*)malloc(cells * sizeof(int));
+        lookahead.buffers[i].berths = (RollBerth*)malloc((cells + 1) * sizeof(RollBerth));
+    }
+    pthread_mutex_init(&lookahead.mutex, NULL);
+    pthread_cond_init(&lookahead.cond, NULL);
+    pthread_cond_init(&lookahead.done, NULL);
+    lookahead.tids = (pthread_t*)calloc(lookahead.threads + 1, sizeof(pthread_t));
+    for (int i = 0; i < lookahead.threads; i++)
+        pthread_create(&lookahead.tids[i], NULL, lookahead_thread, &lookahead.buffers[i]);
+    thread_roles[PORT_SIM_LOOKAHEAD].threads += lookahead.threads;
+}
+
+// Stop and join the workers
+void lookahead_stop() {
+    if (!lookahead.candidates)
+        return;
+    pthread_mutex_lock(&lookahead.mutex);
+    lookahead.stop = 1;
+    pthread_cond_broadcast(&lookahead.cond);
+    pthread_mutex_unlock(&lookahead.mutex);
+    for (int i = 0; i < lookahead.threads; i++)
+        pthread_join(lookahead.tids[i], NULL);
+    for (int i = 0; i <= lookahead.threads; i++) {
+        free(lookahead.buffers[i].grid);
+        free(lookahead.buffers[i].berths);
+    }
+    free(lookahead.buffers);
+    free(lookahead.tids);
+    free(lookahead.grid);
+    free(lookahead.docked);
+    lookahead.candidates = 0;
+}
+
+// Order docked yachts by their top-left slot
+static int roll_berth_cmp(const void* a, const void* b) {
+    const RollBerth* x = (const RollBerth*)a;
+    const RollBerth* y = (const RollBerth*)b;
+    return x->r != y->r ? (x->r > y->r) - (x->r < y->r) : (x->c > y->c) - (x->c < y->c);
+}
+
+// Copy the grid, the docked yachts and the waiting queue for the rollouts
+static void lookahead_snapshot(const Yacht* yacht) {
+    Lookahead* la = &lookahead;
+    size_t slots = (size_t)port_tile_count * TILE_CELLS;
+    for (size_t i = 0; i < slots; i++)
+        la->grid[i] = atomic_load(&port[i].occupied);
+    // A yacht is the rectangle of its ID below and right of its top-left slot
+    la->docked_count = 0;
+    for (int t = 0; t < port_tile_count; t++) {
+        int r0, r1, c0, c1;
+        tile_bounds(port_tiles[t].row, port_tiles[t].col, &r0, &r1, &c0, &c1);
+        for (int r = r0; r <= r1; r++)
+            for (int c = c0; c <= c1; c++) {
+                int v = roll_at(la->grid, r, c);
+                if (v <= 0 || (r > 0 && roll_at(la->grid, r - 1, c) == v) || (c > 0 && roll_at(la->grid, r, c - 1) == v))
+                    continue;
+                int l = 1, w = 1;
+                while (r + l < port_rows && roll_at(la->grid, r + l, c) == v)
+                    l++;
+                while (c + w < port_cols && roll_at(la->grid, r, c + w) == v)
+                    w++;
+                la->docked[la->docked_count++] = (RollBerth){r, c, l, w, 0};
+            }
+    }
+    // Rollouts draw the stays in grid order
+    qsort(la->docked, la->docked_count, sizeof(RollBerth), roll_berth_cmp);
+
+    // Stays are drawn from a seed of their own so the engine's random stream is untouched
+    la->seed = (engine.rng ^ ((uint64_t)yacht->id * 0xD6E8FEB86659FD93ULL)) | 1;
+    uint64_t rng = la->seed;
+    la->queued_count = 0;
+    pthread_mutex_lock(&queue_mutex);
+    for (int i = 0; i < queue_size; i++)
+        if (queue[i].id != yacht->id)
+            la->queued[la->queued_count++] = roll_yacht(&rng, queue[i].length, queue[i].width, queue[i].oil_level,
+                queue[i].need_cleaning + queue[i].need_repair, -queue[i].waiting_time);
+    pthread_mutex_unlock(&queue_mutex);
+    la->queued[la->queued_count] = roll_yacht(&rng, yacht->length, yacht->width, atomic_load(&yacht->oil_level),
+        yacht->need_cleaning + yacht->need_repair, 0);
+}
+
+// Replace the greedy spot (best_r, best_c) of berth class 'required_id' by the
+// candidate with the lowest projected wait
+static void lookahead_choose(const Yacht* yacht, int slots_length, int slots_width, int required_id, int* best_r, int* best_c) {
+    Lookahead* la = &lookahead;
+    int k = required_id == -1 ? 0 : 1, n = 0;
+    for (long i = 0; i < ord_count[slots_width][k] && n < la->candidates; i++) {
+        int r = ord_cands[slots_width][k][i] / port_cols, c = ord_cands[slots_width][k][i] % port_cols;
+        if (r + slots_length <= port_rows && can_dock_here(r, c, slots_length, slots_width, required_id))
+            la->cands[n++] = (DockSpot){r, c, quay_score(r, c, slots_width)};
+    }
+    if (n < 2)
+        return;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    lookahead_snapshot(yacht);
+    pthread_mutex_lock(&la->mutex);
+    la->cand_count = n;
+    memset(la->cost, 0, sizeof(la->cost));
+    memset(la->runs, 0, sizeof(la->runs));
+    long ns = start.tv_nsec + (long)la->budget_ms * 1000000;
+    la->deadline.tv_sec = start.tv_sec + ns / 1000000000;
+    la->deadline.tv_nsec = ns % 1000000000;
+    la->next_task = 0;
+    la->total = n * LOOKAHEAD_ROLLOUTS;
+    pthread_cond_broadcast(&la->cond);
+    lookahead_work(&la->buffers[la->threads]);
+    while (la->running > 0)
+        pthread_cond_wait(&la->done, &la->mutex);
+
+    int pick = 0;
+    for (int i = 1; i < n; i++)
+        if (la->runs[i] && (!la->runs[pick] || la->cost[i] * la->runs[pick] < la->cost[pick] * la->runs[i]))
+            pick = i;
+    pthread_mutex_unlock(&la->mutex);
+
+    la->decisions++;
+    la->moved += pick != 0;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    la->wall_ms += (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    *best_r = la->cands[pick].r;
+    *best_c = la->cands[pick].c;
+}
+
+// Find the best docking spot for a yacht with the selected backend
+void find_best_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id) {
+    if (spec.threads && spec_lookup(slots_length, slots_width, best_r, best_c, best_quay_distance, required_id))
+        return;
+    allocator->find(slots_length, slots_width, best_r, best_c, best_quay_distance, required_id);
+}
+
+// Find the best docking spot of several berth classes (bit 0 free, bit 1 oil
+// pump) at once. Backends without a single-pass search, which stop early anyway,
+// search the classes in turn and skip the oil pumps once a free berth is found:
+// a yacht only takes a fuel berth when no normal one is free.
+void find_best_docking_spots(int slots_length, int slots_width, int classes, DockSpot* best) {
+    clear_spots(best);
+    int todo = 0;
+    for (int k = 0; k < 2; k++) {
+        if (!((classes >> k) & 1))
+            continue;
+        if (!spec.threads || !spec_lookup(slots_length, slots_width, &best[k].r, &best[k].c, &best[k].quay_distance, k == 0 ? -1 : -3))
+            todo |= 1 << k;
+    }
+    if (todo == 3 && allocator->find_multi) {
+        allocator->find_multi(slots_length, slots_width, todo, best);
+        return;
+    }
+    for (int k = 0; k < 2; k++)
+        if (((todo >> k) & 1) && (k == 0 || best[0].r == -1))
+            allocator->find(slots_length, slots_width, &best[k].r, &best[k].c, &best[k].quay_distance, k == 0 ? -1 : -3);
+}
+
+// Rectangle of the grid written while a batch was open
+typedef struct {
+    int r, c;
+    int slots_length, slots_width;
+} GridRect;
+
+// Writes collected between grid_batch_begin and grid_batch_end. The index
+// update, generation bump and worker wake-up of set_cells are done once for
+// all of them when the batch ends.
+typedef struct {
+    int active;
+    GridRect* rects;
+    int size, cap;
+} GridBatch;
+GridBatch grid_batch;
+
+// Write 'value' into a rectangle of slots and update the search index. A value
+// of 0 restores each slot to its layout value, or -4 while it is kept clear.
+void set_cells(int r, int c, int slots_length, int slots_width, int value) {
+    if (!grid_batch.active || grid_batch.size == 0)
+        atomic_fetch_add(&grid_generation, 1); // Odd: grid is being written
+    for (int i = 0; i < slots_length; i++)
+        for (int j = 0; j < slots_width; j++) {
+            PortSlot* slot = &CELL(r + i, c + j);
+            atomic_store(&slot->occupied, value ? value : slot->keep_clear ? -4 : slot->base);
+        }
+    if (grid_batch.active) {
+        if (grid_batch.size == grid_batch.cap) {
+            grid_batch.cap = grid_batch.cap ? grid_batch.cap * 2 : 64;
+            grid_batch.rects = (GridRect*)realloc(grid_batch.rects, grid_batch.cap * sizeof(GridRect));
+        }
+        grid_batch.rects[grid_batch.size++] = (GridRect){r, c, slots_length, slots_width};
+        return;
+    }
+    reach_update(r, c, slots_length, slots_width);
+    if (allocator->update)
+        allocator->update(r, c, slots_length, slots_width);
+    atomic_fetch_add(&grid_generation, 1);
+    if (spec.threads) {
+        pthread_mutex_lock(&spec.mutex);
+        pthread_cond_broadcast(&spec.cond);
+        pthread_mutex_unlock(&spec.mutex);
+    }
+}
+
+// Collect the following grid writes into one batch
+void grid_batch_begin() {
+    grid_batch.active = 1;
+    grid_batch.size = 0;
+}
+
+// Bring the search index up to date with all writes of the batch
+void grid_batch_end() {
+    grid_batch.active = 0;
+    if (grid_batch.size == 0)
+        return;
+    for (int i = 0; i < grid_batch.size; i++) {
+        GridRect* rect = &grid_batch.rects[i];
+        reach_update(rect->r, rect->c, rect->slots_length, rect->slots_width);
+        if (allocator->update)
+            allocator->update(rect->r, rect->c, rect->slots_length, rect->slots_width);
+    }
+    grid_batch.size = 0;
+    atomic_fetch_add(&grid_generation, 1);
+    if (spec.threads) {
+        pthread_mutex_lock(&spec.mutex);
+        pthread_cond_broadcast(&spec.cond);
+        pthread_mutex_unlock(&spec.mutex);
+    }
+}
+
+// Berth classes a waiting yacht may take (bit 0 free, bit 1 oil pump)
+int dock_classes(const Yacht* yacht) {
+    if (atomic_load(&yacht->oil_level) < 50)
+        return 2; // Only the special low-oil dock
+    if (yacht->waiting_time >= 15)
+        return 3; // Waiting too long: normal docking first, fuel station otherwise
+    return 1;
+}
+
+// Assign a yacht to a port slot
+void assign_to_port(Yacht* yacht) {
+    pthread_mutex_lock(&port_mutex);
+    place_yacht(yacht);
+    pthread_mutex_unlock(&port_mutex);
+}
+
+// Dock a waiting yacht at the best berth it may take, if any. The caller holds port_mutex.
+void place_yacht(Yacht* yacht) {
+    int slots_length = ceil((double)yacht->length / SLOT_SIZE);
+    int slots_width  = ceil((double)yacht->width / SLOT_SIZE);
+
+    int best_r, best_c, best_quay_distance;
+    int can_dock = 0, docked_on_fuel = 0;
+    int classes = dock_classes(yacht);
+
+    if (classes == 2) {
+        // Only allow docking in slots with occupied == -3 (special low-oil dock)
+        find_best_docking_spot(slots_length, slots_width, &best_r, &best_c, &best_quay_distance, -3);
+        if (best_r != -1 && best_c != -1) {
+            can_dock = 1; docked_on_fuel = 1;
+        }
+    } else if (classes == 3) {
+        // Both searches in one pass
+        DockSpot best[2];
+        find_best_docking_spots(slots_length, slots_width, 3, best);
+        int k = best[0].r != -1 ? 0 : 1;
+        best_r = best[k].r;
+        best_c = best[k].c;
+        if (best_r != -1)
+            can_dock = 1, docked_on_fuel = k == 1;
+    } else {
+        // Normal docking
+        find_best_docking_spot(slots_length, slots_width, &best_r, &best_c, &best_quay_distance, -1);
+        if (best_r != -1 && best_c != -1)
+            can_dock = 1;
+    }
+
+    if (can_dock) {
+        if (lookahead.candidates)
+            lookahead_choose(yacht, slots_length, slots_width, docked_on_fuel ? -3 : -1, &best_r, &best_c);
+        set_cells(best_r, best_c, slots_length, slots_width, yacht->id);
+        yacht->dock_row = best_r;
+        yacht->dock_col = best_c;
+
+        if (docked_on_fuel)
+            atomic_store(&yacht->state, 4); // docked at fuel station
+        else
+            atomic_store(&yacht->state, 2); // docked
+
+        // Remove yacht from the queue
+        pthread_mutex_lock(&queue_mutex);
+        for (int i = 0; i < queue_size; i++) {
+            if (queue[i].id == yacht->id) {
+                for (int j = i; j < queue_size - 1; j++)
+                    queue[j] = queue[j + 1];
+                queue_size--;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&queue_mutex);
+
+        // Add to docked list
+        pthread_mutex_lock(&docked_mutex);
+        if (docked_size < MAX_DOCKED)
+            docked[docked_size++] = *yacht;
+        pthread_mutex_unlock(&docked_mutex);
+    }
+}
+
+// Release a port slot when a yacht leaves
+void release_slot(Yacht* yacht) {
+    pthread_mutex_lock(&port_mutex);
+    vacate_slot(yacht);
+    pthread_mutex_unlock(&port_mutex);
+}
+
+// Free the berth of a yacht and drop it from the docked list. The caller holds port_mutex.
+void vacate_slot(Yacht* yacht) {
+    int slots_length = ceil((double)yacht->length / SLOT_SIZE);
+    int slots_width = ceil((double)yacht->width / SLOT_SIZE);
+
+    if (yacht->dock_row >= 0) {
+        trace_event(TR_RELEASE, yacht, yacht->dock_row, yacht->dock_col, 0);
+        // Restore each slot to its layout value (oil pump or free)
+        set_cells(yacht->dock_row, yacht->dock_col, slots_length, slots_width, 0);
+    }
+    yacht->dock_row = yacht->dock_col = -1;
+    // Remove yacht from docked list safely
+    pthread_mutex_lock(&docked_mutex);
+    for (int i = 0; i < docked_size; i++) {
+        if (docked[i].id == yacht->id) {
+            for (int j = i; j < docked_size - 1; j++)
+                docked[j] = docked[j + 1];
+            docked_size--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&docked_mutex);
+}
+
+// Set up an io_uring instance for the output thread and register the buffers
+static int out_ring_init(OutRing* ring) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = syscall(__NR_io_uring_setup, OUT_URING_ENTRIES, &p);
+    if (ring->fd < 0)
+        return -1;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len)
+            ring->sq_len = ring->cq_len;
+        ring->cq_len = ring->sq_len;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ptr = ring->sq_ptr;
+    else
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED)
+        goto fail;
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
+
+    char* sq = ring->sq_ptr;
+    char* cq = ring->cq_ptr;
+    ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    struct iovec iov[OUT_BUFS];
+    for (int i = 0; i < OUT_BUFS; i++) {
+        iov[i].iov_base = output.bufs[i];
+        iov[i].iov_len = OUT_BUF_SIZE;
+    }
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, OUT_BUFS) < 0)
+        goto fail;
+    return 0;
+
+fail:
+    // Unmap whatever was mapped before the failure
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->fd);
+    ring->fd = -1;
+    return -1;
+}
+
+// Note a buffer that could not be written: its stream keeps the first error and
+// the summary counts the failures
+static void out_fail(OutRequest* r, int err) {
+    int none = 0;
+    atomic_compare_exchange_strong(&r->stream->error, &none, err);
+    if (output.failed_writes++ == 0)
+        output.error = err;
+}
+
+// Write the part of a request from byte 'from' on with pwrite, retrying after
+// interrupts and short writes
+static void out_pwrite_rest(OutRequest* r, size_t from) {
+    while (from < r->len) {
+        ssize_t w = pwrite(r->fd, output.bufs[r->buf] + from, r->len - from, r->offset + from);
+        output.write_calls++;
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            out_fail(r, w < 0 ? errno : EIO);
+            return;
+        }
+        output.bytes_written += w;
+        from += w;
+    }
+}
+
+// Write a batch of requests with one io_uring submission and wait for all
+// completions. Failed and short writes are finished with pwrite. A buffer the
+// kernel may still read is never handed back: if the ring cannot be waited on,
+// its memory is abandoned and the buffer index gets new memory, or is retired
+// if there is none.
+static void out_write_uring(OutRequest* reqs, int n) {
+    OutRing* ring = &output.ring;
+    unsigned tail = *ring->sq_tail;
+    for (int i = 0; i < n; i++) {
+        unsigned idx = tail & *ring->sq_mask;
+        struct io_uring_sqe* sqe = &ring->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = reqs[i].fd;
+        sqe->off = reqs[i].offset;
+        sqe->addr = (unsigned long)output.bufs[reqs[i].buf];
+        sqe->len = reqs[i].len;
+        sqe->buf_index = reqs[i].buf;
+        sqe->user_data = i;
+        ring->sq_array[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    output.write_calls += n;
+
+    int submitted = 0;
+    while (submitted < n) {
+        int ret = syscall(__NR_io_uring_enter, ring->fd, n - submitted, 0, 0, NULL, 0);
+        if (ret < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+            continue;
+        if (ret <= 0)
+            break;
+        submitted += ret;
+    }
+    if (submitted < n) {
+        // The kernel consumes entries in order: take back the ones it did not,
+        // write them with pwrite and leave io_uring for the rest of the run
+        __atomic_store_n(ring->sq_tail, tail - (n - submitted), __ATOMIC_RELEASE);
+        for (int i = submitted; i < n; i++)
+            out_pwrite_rest(&reqs[i], 0);
+        output.use_uring = 0;
+    }
+
+    char completed[OUT_BUFS] = {0};
+    int done = 0;
+    while (done < submitted) {
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            OutRequest* r = &reqs[cqe->user_data];
+            if (cqe->res < 0) {
+                out_pwrite_rest(r, 0);
+            } else {
+                output.bytes_written += cqe->res;
+                out_pwrite_rest(r, cqe->res);
+            }
+            completed[cqe->user_data] = 1;
+            head++;
+            done++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        if (done == submitted)
+            break;
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, submitted - done, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            int err = errno;
+            for (int i = 0; i < submitted; i++) {
+                if (!completed[i]) {
+                    out_fail(&reqs[i], err);
+                    output.bufs[reqs[i].buf] = aligned_alloc(4096, OUT_BUF_SIZE); // NULL retires it
+                }
+            }
+            output.use_uring = 0;
+            break;
+        }
+    }
+}
+
+// Write a batch of requests with pwritev, merging contiguous buffers of the same
+// file. Whatever a call leaves unwritten is retried buffer by buffer with pwrite.
+static void out_write_pwritev(OutRequest* reqs, int n) {
+    for (int i = 0; i < n;) {
+        struct iovec iov[OUT_BUFS];
+        int cnt = 0;
+        off_t end = reqs[i].offset;
+        do {
+            iov[cnt].iov_base = output.bufs[reqs[i + cnt].buf];
+            iov[cnt].iov_len = reqs[i + cnt].len;
+            end += reqs[i + cnt].len;
+            cnt++;
+        } while (i + cnt < n && reqs[i + cnt].fd == reqs[i].fd && reqs[i + cnt].offset == end);
+
+        ssize_t w = pwritev(reqs[i].fd, iov, cnt, reqs[i].offset);
+        output.write_calls++;
+        if (w < 0 && errno == EINTR)
+            continue;
+        size_t left = w < 0 ? 0 : w;
+        for (int k = 0; k < cnt; k++) {
+            OutRequest* r = &reqs[i + k];
+            size_t part = left < r->len ? left : r->len;
+            output.bytes_written += part;
+            left -= part;
+            out_pwrite_rest(r, part);
+        }
+        i += cnt;
+    }
+}
+
+// Output thread: take every queued buffer, write them as one batch, recycle them
+static void* output_thread(void* arg) {
+    (void)arg;
+    role_enter(PORT_SIM_OUTPUT);
+    pthread_mutex_lock(&output.mutex);
+    while (1) {
+        while (output.pending_count == 0 && !output.stop)
+            pthread_cond_wait(&output.work_cond, &output.mutex);
+        if (output.pending_count == 0)
+            break;
+
+        OutRequest batch[OUT_BUFS];
+        int n = output.pending_count;
+        for (int i = 0; i < n; i++)
+            batch[i] = output.pending[(output.pending_head + i) % OUT_BUFS];
+        output.pending_head = (output.pending_head + n) % OUT_BUFS;
+        output.pending_count = 0;
+        output.inflight = n;
+        pthread_mutex_unlock(&output.mutex);
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (output.use_uring)
+            out_write_uring(batch, n);
+        else
+            out_write_pwritev(batch, n);
+        // Durable streams get one sync per batch, which commits everything queued
+        // since the last one as a group
+        for (int i = 0; i < n; i++) {
+            int first = batch[i].sync;
+            for (int j = 0; j < i && first; j++)
+                first = !(batch[j].sync && batch[j].fd == batch[i].fd);
+            if (first) {
+                if (fdatasync(batch[i].fd) == 0) {
+                    output.syncs++;
+                } else {
+                    int none = 0;
+                    atomic_compare_exchange_strong(&batch[i].stream->error, &none, errno);
+                    output.failed_syncs++;
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        pthread_mutex_lock(&output.mutex);
+        output.busy_sec += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        output.batches++;
+        output.inflight = 0;
+        for (int i = 0; i < n; i++) {
+            if (output.bufs[batch[i].buf])
+                output.free_bufs[output.free_count++] = batch[i].buf;
+            else
+                output.buf_count--;
+        }
+        pthread_cond_broadcast(&output.free_cond);
+    }
+    pthread_mutex_unlock(&output.mutex);
+    role_leave(PORT_SIM_OUTPUT);
+    return NULL;
+}
+
+// Allocate the output buffers and start the output thread
+void output_start() {
+    memset(&output, 0, sizeof(output));
+    pthread_mutex_init(&output.mutex, NULL);
+    pthread_cond_init(&output.work_cond, NULL);
+    pthread_cond_init(&output.free_cond, NULL);
+    for (int i = 0; i < OUT_BUFS; i++)
+        if ((output.bufs[i] = aligned_alloc(4096, OUT_BUF_SIZE)))
+            output.free_bufs[output.free_count++] = i;
+    output.buf_count = output.free_count;
+    // io_uring writes from the registered set of all buffers
+    output.ring.fd = -1;
+    output.use_uring = output.buf_count == OUT_BUFS && out_ring_init(&output.ring) == 0;
+    output.active = 1;
+    pthread_create(&output.thread, NULL, output_thread, NULL);
+    thread_roles[PORT_SIM_OUTPUT].threads++;
+}
+
+// Drain the pipeline, stop the output thread and release its resources
+void output_stop() {
+    if (!output.active)
+        return;
+    pthread_mutex_lock(&output.mutex);
+    output.stop = 1;
+    pthread_cond_signal(&output.work_cond);
+    pthread_mutex_unlock(&output.mutex);
+    pthread_join(output.thread, NULL);
+
+    if (output.ring.fd >= 0) {
+        munmap(output.ring.sqes, output.ring.sqes_len);
+        if (output.ring.cq_ptr != output.ring.sq_ptr)
+            munmap(output.ring.cq_ptr, output.ring.cq_len);
+        munmap(output.ring.sq_ptr, output.ring.sq_len);
+        close(output.ring.fd);
+    }
+    for (int i = 0; i < OUT_BUFS; i++)
+        free(output.bufs[i]);
+    output.active = 0;
+}
+
+// Take a free buffer, waiting for the output thread if all are in flight; -1 if
+// every buffer has been retired
+static int out_get_buffer() {
+    pthread_mutex_lock(&output.mutex);
+    if (output.free_count == 0) {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        while (output.free_count == 0 && output.buf_count > 0)
+            pthread_cond_wait(&output.free_cond, &output.mutex);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        output.stall_sec += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    }
+    int buf = output.free_count > 0 ? output.free_bufs[--output.free_count] : -1;
+    pthread_mutex_unlock(&output.mutex);
+    return buf;
+}
+
+// Queue the current buffer of a stream for writing
+static void out_submit(OutStream* s) {
+    if (s->buf < 0 || s->len == 0)
+        return;
+    pthread_mutex_lock(&output.mutex);
+    OutRequest* r = &output.pending[(output.pending_head + output.pending_count) % OUT_BUFS];
+    r->fd = s->fd;
+    r->offset = s->offset;
+    r->buf = s->buf;
+    r->len = s->len;
+    r->sync = s->sync;
+    r->stream = s;
+    output.pending_count++;
+    pthread_cond_signal(&output.work_cond);
+    pthread_mutex_unlock(&output.mutex);
+
+    s->offset += s->len;
+    s->buf = -1;
+    s->len = 0;
+}
+
+// Open an output file written through the pipeline
+OutStream* out_open(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    return out_attach(fd, 0);
+}
+
+// Write an open file through the pipeline, starting at 'offset'
+OutStream* out_attach(int fd, off_t offset) {
+    if (!output.active)
+        output_start();
+    OutStream* s = (OutStream*)calloc(1, sizeof(OutStream));
+    s->fd = fd;
+    s->offset = offset;
+    s->buf = -1;
+    return s;
+}
+
+// Append bytes to a stream; only blocks if every buffer is still being written
+void out_write(OutStream* s, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    s->bytes += len;
+    while (len > 0) {
+        if (s->buf < 0 && (s->buf = out_get_buffer()) < 0) {
+            // No memory left to write through: the stream fails with what it has
+            int none = 0;
+            atomic_compare_exchange_strong(&s->error, &none, ENOMEM);
+            output.dropped_bytes += len;
+            return;
+        }
+        size_t n = OUT_BUF_SIZE - s->len;
+        if (n > len)
+            n = len;
+        memcpy(output.bufs[s->buf] + s->len, p, n);
+        s->len += n;
+        p += n;
+        len -= n;
+        if (s->len == OUT_BUF_SIZE)
+            out_submit(s);
+    }
+}
+
+// Flush the last partial buffer and close the stream once it is written
+void out_close(OutStream* s) {
+    if (!s)
+        return;
+    out_submit(s);
+    pthread_mutex_lock(&output.mutex);
+    while (output.pending_count > 0 || output.inflight > 0)
+        pthread_cond_wait(&output.free_cond, &output.mutex);
+    pthread_mutex_unlock(&output.mutex);
+    close(s->fd);
+    free(s);
+}
+
+// Write-ahead log (--wal DIR): every state change the engine traces (enqueue,
+// dock, release, crew start and finish, manoeuvres, departures) is appended as
+// a trace record to DIR/wal-TICK, the log of the snapshot DIR/snapshot taken at
+// TICK. Records are committed in groups through the output pipeline: a partial
+// buffer is submitted every WAL_COMMIT_MS of wall time and the output thread
+// syncs the log once per write batch. The engine is deterministic, so after a
+// crash the run resumes from the snapshot and replays the log tail by running
+// the engine again, checking every record it produces against the log. Records
+// that were not committed yet are simply produced again.
+#define WAL_COMMIT_MS 20                 // Wall time between group commits
+#define WAL_HEADER_SIZE 16               // "YPWAL001" and the tick of the snapshot
+
+typedef struct {
+    int active;
+    char dir[256];
+    OutStream* out;               // Current log
+    uint64_t log_tick;            // Tick of the snapshot the current log starts from
+    int snapshot_interval;        // Simulated seconds between snapshots
+    uint64_t next_snapshot;       // Tick of the next snapshot
+    struct timespec last_commit;
+    TraceRecord* replay;          // Log tail being replayed after a restart, NULL once done
+    long replay_count, replay_pos;
+    long records, commits, snapshots;
+    double snapshot_ms;           // Wall time spent writing snapshots
+    int recovered;                // The run resumed from a snapshot
+    uint64_t recovered_tick;      // Tick of that snapshot
+    uint64_t replayed_tick;       // Tick at which the replay ended
+    struct timespec recovery_start;
+    long replayed;                // Log records reproduced by the replay
+    int diverged;                 // The replay produced a record that differs from the log
+    double recovery_ms;           // Wall time from opening the snapshot to the end of the replay
+    int caught_up;                // The replay is over
+    int failed;                   // errno of the write or sync of the log that stopped logging, 0 if none
+} WriteAheadLog;
+WriteAheadLog wal;
+
+// Append a record to the log, or check it against the log tail while replaying.
+// A record that differs ends the replay: the rest of the log is dropped and the
+// run goes on from there.
+static void wal_log(const TraceRecord* rec) {
+    if (wal.replay) {
+        if (memcmp(rec, &wal.replay[wal.replay_pos], sizeof(*rec)) == 0) {
+            wal.replayed++;
+            if (++wal.replay_pos == wal.replay_count) {
+                free(wal.replay);
+                wal.replay = NULL;
+            }
+            return;
+        }
+        wal.diverged = 1;
+        wal.out->offset = WAL_HEADER_SIZE + (off_t)wal.replay_pos * sizeof(TraceRecord);
+        if (ftruncate(wal.out->fd, wal.out->offset) < 0)
+            perror("wal");
+        free(wal.replay);
+        wal.replay = NULL;
+    }
+    out_write(wal.out, rec, sizeof(*rec));
+    wal.records++;
+}
+
+// Append one record to the event trace and the write-ahead log, if enabled
+void trace_event(int type, Yacht* yacht, int a, int b, int c) {
+    if (!trace_out && !wal.active)
+        return;
+    TraceRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.tick = engine.wheel.now;
+    rec.yacht_id = yacht ? yacht->id : -1;
+    rec.type = type;
+    rec.a = a;
+    rec.b = b;
+    rec.c = c;
+    if (trace_out) {
+        out_write(trace_out, &rec, sizeof(rec));
+        trace_index_add(&trace_index, &rec);
+    }
+    if (wal.active)
+        wal_log(&rec);
+}
+
+// Append one line of time-series metrics
+static void sample_metrics() {
+    char line[160];
+    int busy = 0;
+    for (int i = 0; i < crew_count; i++)
+        busy += atomic_load(&crews[i].state) == 1;
+    int n = snprintf(line, sizeof(line), "%.1f,%d,%d,%d,%.2f,%d,%d\n",
+        (double)engine.wheel.now / TICKS_PER_SEC, queue_size, docked_size,
+        stats.total_yachts_serviced,
+        stats.total_yachts_serviced ? (double)stats.total_waiting_time / stats.total_yachts_serviced : 0.0,
+        busy, engine.wheel.pending);
+    out_write(metrics_out, line, n);
+}
+
+// Print output bandwidth figures for the run summary
+void print_output_summary(double wall) {
+    if (trace_index.records > 0)
+        printf("Trace index: %lu records in %ld blocks, %ld yachts with %ld block entries\n",
+            (unsigned long)trace_index.records, trace_index.blocks, trace_index.yachts, trace_index.posting_count);
+    if (output.dropped_bytes)
+        printf("Output dropped for lack of buffers: %ld bytes\n", output.dropped_bytes);
+    if (output.batches == 0)
+        return;
+    double mb = output.bytes_written / 1e6;
+    printf("Output: %.2f MB in %ld writes / %ld batches via %s | %.1f MB/s of run time, %.1f MB/s while writing | Engine stalled %.3f s\n",
+        mb, output.write_calls, output.batches, output.use_uring ? "io_uring" : "pwritev",
+        wall > 0 ? mb / wall : 0.0, output.busy_sec > 0 ? mb / output.busy_sec : 0.0, output.stall_sec);
+    if (output.failed_writes)
+        printf("Failed output writes: %ld (first error: %s)\n",
+            output.failed_writes, strerror(output.error));
+    if (output.failed_syncs)
+        printf("Failed syncs: %ld\n", output.failed_syncs);
+}
+
+// Take a timer node from the free list, refilling it with a chunk from the arena
+static Timer* timer_alloc(TimingWheel* w) {
+    if (!w->free_list) {
+        Timer* chunk = (Timer*)arena_alloc(REGISTRY_CHUNK * sizeof(Timer));
+        if (!chunk)
+            arena_exhausted("timer_alloc");
+        for (int i = 0; i < REGISTRY_CHUNK; i++) {
+            chunk[i].next = w->free_list;
+            w->free_list = &chunk[i];
+        }
+    }
+    Timer* t = w->free_list;
+    w->free_list = t->next;
+    return t;
+}
+
+// Link a timer into the wheel slot matching its expiry
+static void wheel_insert(TimingWheel* w, Timer* t) {
+    uint64_t expires = t->expires < w->now ? w->now : t->expires;
+    uint64_t delta = expires - w->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_BITS * (level + 1)))
+        level++;
+    if (delta >> (WHEEL_BITS * WHEEL_LEVELS)) // Beyond the wheel horizon: park it, it is re-cascaded later
+        expires = w->now + ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+    Timer** slot = &w->slots[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    t->next = *slot;
+    *slot = t;
+}
+
+// Arm a timer firing at the absolute tick 'expires'
+void wheel_add(TimingWheel* w, uint64_t expires, int type, void* arg, int data) {
+    Timer* t = timer_alloc(w);
+    t->expires = expires;
+    t->type = type;
+    t->arg = arg;
+    t->data = data;
+    wheel_insert(w, t);
+    if (++w->pending > w->max_pending)
+        w->max_pending = w->pending;
+}
+
+// Move all timers of the current slot of 'level' one or more levels down
+static int wheel_cascade(TimingWheel* w, int level) {
+    int idx = (w->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    Timer* t = w->slots[level][idx];
+    w->slots[level][idx] = NULL;
+    while (t) {
+        Timer* next = t->next;
+        wheel_insert(w, t);
+        t = next;
+    }
+    return idx;
+}
+
+// Fire every timer due at the current tick, then advance the clock by one tick
+void wheel_advance(TimingWheel* w) {
+    int idx = w->now & WHEEL_MASK;
+    if (idx == 0)
+        for (int level = 1; level < WHEEL_LEVELS && wheel_cascade(w, level) == 0; level++);
+
+    // Handlers may arm timers for the current tick, so drain until the slot stays empty
+    Timer* t;
+    while ((t = w->slots[0][idx]) != NULL) {
+        w->slots[0][idx] = t->next;
+        int type = t->type, data = t->data;
+        void* arg = t->arg;
+        t->next = w->free_list;
+        w->free_list = t;
+        w->pending--;
+        w->fired++;
+        engine_fire(type, arg, data);
+    }
+    engine_flush_batch();
+    w->now++;
+}
+
+// Earliest expiry among the armed timers, UINT64_MAX if there are none
+uint64_t wheel_next_expiry(TimingWheel* w) {
+    if (w->pending == 0)
+        return UINT64_MAX;
+    // Level 0 slots map one-to-one onto the next WHEEL_SLOTS ticks
+    for (int i = 0; i < WHEEL_SLOTS; i++)
+        if (w->slots[0][(w->now + i) & WHEEL_MASK])
+            return w->now + i;
+    // Otherwise the first non-empty slot after the current one on each higher level holds its earliest timers
+    uint64_t best = UINT64_MAX;
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        int idx = (w->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        for (int i = 1; i <= WHEEL_SLOTS; i++) {
+            Timer* t = w->slots[level][(idx + i) & WHEEL_MASK];
+            if (!t)
+                continue;
+            for (; t; t = t->next)
+                if (t->expires < best)
+                    best = t->expires;
+            break;
+        }
+    }
+    return best;
+}
+
+// Manoeuvring planner: yachts sail from the sea to their berth and back through
+// the water slots, one slot per second, instead of appearing in place. Paths are
+// planned one yacht at a time with space-time A* (cooperative A*): every planned
+// path goes into a shared reservation table of (second, slot) pairs, and later
+// plans avoid those pairs and head-on swaps by taking other slots, waiting in
+// place or waiting at sea. A yacht under way is planned as a single slot; at its
+// berth it occupies its whole footprint, so an inbound plan only arrives once no
+// other yacht is booked through the footprint. The heuristic comes from the
+// layout: the distance of every slot to the sea, computed once per port. It is
+// stored for the slots of the populated tiles; a tile of open water keeps the
+// distances along its four edges instead, each edge slot lowered to what it can
+// reach along the edge, from which the distance of any slot inside follows.
+#define PLAN_SLACK 120               // Seconds a plan may take beyond the free-flow distance
+#define PLAN_MAX_EXPANSIONS (1 << 16) // Nodes expanded before a plan is retried a second later
+
+typedef struct {
+    uint64_t key;                 // (second + 1) << 32 | slot, 0 if never used
+    int yacht;                    // Yacht ID holding the slot at that second
+} Reservation;
+
+typedef struct {
+    uint64_t key;                 // (time << 32) | slot
+    int stamp;                    // Plan that visited the pair; other stamps count as empty
+} PlanVisit;
+
+typedef struct {
+    int slot;                     // Grid slot, or the sea (one past the last slot)
+    int g;                        // Seconds since the start of the plan
+    int f;                        // g plus the heuristic
+    int parent;                   // Previous node of the path, -1 at the start
+} PlanNode;
+
+// Moves to the sea of a tile of open water through its edges: top[j] is the
+// fewest moves from slot j of the top row along that row to a slot of it, and
+// from there to the sea; likewise for the other edges. INT_MAX if there is no way.
+typedef struct {
+    int top[TILE_SIZE], bottom[TILE_SIZE];  // By column of the tile
+    int left[TILE_SIZE], right[TILE_SIZE];  // By row of the tile
+} PlanEdges;
+
+typedef struct {
+    int* exit_dist;               // Moves from every slot of port to the sea over the layout, INT_MAX if none
+    PlanEdges* open_exit;         // The same for every tile of open water
+    int sea;                      // Slot index standing for the sea
+    Reservation* resv;            // Open addressing; entries of past seconds are expired
+    size_t resv_cap, resv_used;   // resv_used counts expired entries until the next rebuild
+    uint64_t now;                 // Current second, for expiry
+    uint64_t latest;              // Latest second reserved so far
+    PlanVisit* visited;
+    size_t visited_cap, visited_used;
+    int stamp;
+    PlanNode* nodes;
+    int node_count, node_cap;
+    int* heap;                    // Node indexes ordered by f, deeper nodes first on ties
+    int heap_size;
+    long plans, replans, expansions;
+    long ways_held;               // Boxed-in yachts that had a way out kept clear
+    long seconds, delay;          // Total seconds under way, and lost to other yachts
+} Planner;
+Planner planner;
+
+static inline size_t plan_hash(uint64_t key, size_t cap) {
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (cap - 1);
+}
+
+// Yacht holding 'slot' at 'second', 0 if it is free
+static int resv_get(uint64_t second, int slot) {
+    uint64_t key = (second + 1) << 32 | (uint32_t)slot;
+    for (size_t i = plan_hash(key, planner.resv_cap); planner.resv[i].key; i = (i + 1) & (planner.resv_cap - 1))
+        if (planner.resv[i].key == key)
+            return planner.resv[i].yacht;
+    return 0;
+}
+
+// Rehash the reservations that have not expired into a table of fitting size
+static void resv_rebuild() {
+    size_t live = 0, cap = 4096;
+    for (size_t i = 0; i < planner.resv_cap; i++)
+        live += planner.resv[i].key && (planner.resv[i].key >> 32) - 1 >= planner.now;
+    while (cap < live * 4)
+        cap *= 2;
+    Reservation* old = planner.resv;
+    size_t old_cap = planner.resv_cap;
+    planner.resv = (Reservation*)calloc(cap, sizeof(Reservation));
+    planner.resv_cap = cap;
+    planner.resv_used = live;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (!old[i].key || (old[i].key >> 32) - 1 < planner.now)
+            continue;
+        size_t j = plan_hash(old[i].key, cap);
+        while (planner.resv[j].key)
+            j = (j + 1) & (cap - 1);
+        planner.resv[j] = old[i];
+    }
+    free(old);
+}
+
+static void resv_put(uint64_t second, int slot, int yacht) {
+    if ((planner.resv_used + 1) * 2 > planner.resv_cap)
+        resv_rebuild();
+    uint64_t key = (second + 1) << 32 | (uint32_t)slot;
+    size_t i = plan_hash(key, planner.resv_cap);
+    // Expired entries are reused, but they still link probe chains until the next rebuild
+    while (planner.resv[i].key && (planner.resv[i].key >> 32) - 1 >= planner.now)
+        i = (i + 1) & (planner.resv_cap - 1);
+    planner.resv_used += planner.resv[i].key == 0;
+    planner.resv[i].key = key;
+    planner.resv[i].yacht = yacht;
+    if (second > planner.latest)
+        planner.latest = second;
+}
+
+// Mark (g, slot) as visited by the current plan, returns 0 if it already was
+static int plan_visit(int g, int slot) {
+    if ((planner.visited_used + 1) * 2 > planner.visited_cap) {
+        PlanVisit* old = planner.visited;
+        size_t old_cap = planner.visited_cap;
+        planner.visited_cap = old_cap ? old_cap * 2 : 4096;
+        planner.visited = (PlanVisit*)calloc(planner.visited_cap, sizeof(PlanVisit));
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i].stamp != planner.stamp)
+                continue;
+            size_t j = plan_hash(old[i].key, planner.visited_cap);
+            while (planner.visited[j].stamp == planner.stamp)
+                j = (j + 1) & (planner.visited_cap - 1);
+            planner.visited[j] = old[i];
+        }
+        free(old);
+    }
+    uint64_t key = (uint64_t)g << 32 | (uint32_t)slot;
+    size_t i = plan_hash(key, planner.visited_cap);
+    for (; planner.visited[i].stamp == planner.stamp; i = (i + 1) & (planner.visited_cap - 1))
+        if (planner.visited[i].key == key)
+            return 0;
+    planner.visited[i].key = key;
+    planner.visited[i].stamp = planner.stamp;
+    planner.visited_used++;
+    return 1;
+}
+
+static inline int plan_less(int a, int b) {
+    const PlanNode* x = &planner.nodes[a];
+    const PlanNode* y = &planner.nodes[b];
+    return x->f < y->f || (x->f == y->f && x->g > y->g);
+}
+
+static void plan_push(int slot, int g, int f, int parent) {
+    if (planner.node_count == planner.node_cap) {
+        planner.node_cap = planner.node_cap ? planner.node_cap * 2 : 4096;
+        planner.nodes = (PlanNode*)realloc(planner.nodes, planner.node_cap * sizeof(PlanNode));
+        planner.heap = (int*)realloc(planner.heap, planner.node_cap * sizeof(int));
+    }
+    int n = planner.node_count++;
+    planner.nodes[n] = (PlanNode){slot, g, f, parent};
+    int i = planner.heap_size++;
+    while (i > 0 && plan_less(n, planner.heap[(i - 1) / 2])) {
+        planner.heap[i] = planner.heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    planner.heap[i] = n;
+}
+
+static int plan_pop() {
+    int top = planner.heap[0], last = planner.heap[--planner.heap_size], i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= planner.heap_size)
+            break;
+        if (child + 1 < planner.heap_size && plan_less(planner.heap[child + 1], planner.heap[child]))
+            child++;
+        if (!plan_less(planner.heap[child], last))
+            break;
+        planner.heap[i] = planner.heap[child];
+        i = child;
+    }
+    planner.heap[i] = last;
+    return top;
+}
+
+// Flood of plan_init from the sea, one distance at a time. A tile of open water
+// gets a page of distances while the flood crosses it, which is dropped for the
+// distances along its edges once every slot of the tile has been reached.
+typedef struct {
+    int* cur;                     // Slots at the current distance
+    int* next;                    // Slots at the next distance
+    long cur_count, cur_cap, next_count, next_cap;
+    int** pages;                  // By tile of open water, NULL before and after the flood crosses it
+    int* left;                    // Slots of the tile the flood has yet to reach, -1 before it starts
+    int failed;                   // Out of memory
+} PlanFlood;
+
+// Give slot (r, c) distance d unless the flood has been there
+static void plan_flood_reach(PlanFlood* f, int r, int c, int d) {
+    if (CELL(r, c).base == -2)
+        return;
+    long i = slot_index(r, c);
+    if (i >= 0) {
+        if (planner.exit_dist[i] != INT_MAX)
+            return;
+        planner.exit_dist[i] = d;
+    } else {
+        int o = -1 - port_tile_dir[(r >> TILE_BITS) * port_tile_cols + (c >> TILE_BITS)];
+        int r0, r1, c0, c1;
+        tile_bounds(r >> TILE_BITS, c >> TILE_BITS, &r0, &r1, &c0, &c1);
+        if (f->left[o] == 0)
+            return;
+        if (!f->pages[o]) {
+            if (!(f->pages[o] = (int*)malloc(TILE_CELLS * sizeof(int)))) {
+                f->failed = 1;
+                return;
+            }
+            for (int k = 0; k < TILE_CELLS; k++)
+                f->pages[o][k] = INT_MAX;
+            f->left[o] = (r1 - r0 + 1) * (c1 - c0 + 1);
+        }
+        int* page = f->pages[o];
+        int* p = &page[(r - r0) << TILE_BITS | (c - c0)];
+        if (*p != INT_MAX)
+            return;
+        *p = d;
+        if (--f->left[o] == 0) {
+            PlanEdges* e = &planner.open_exit[o];
+            for (int j = 0; j <= c1 - c0; j++) {
+                e->top[j] = page[j];
+                e->bottom[j] = page[(r1 - r0) << TILE_BITS | j];
+            }
+            for (int k = 0; k <= r1 - r0; k++) {
+                e->left[k] = page[k << TILE_BITS];
+                e->right[k] = page[k << TILE_BITS | (c1 - c0)];
+            }
+            free(page);
+            f->pages[o] = NULL;
+        }
+    }
+    if (f->next_count == f->next_cap) {
+        f->next_cap = f->next_cap ? f->next_cap * 2 : 4096;
+        int* grown = (int*)realloc(f->next, f->next_cap * sizeof(int));
+        if (!grown) {
+            f->failed = 1;
+            return;
+        }
+        f->next = grown;
+    }
+    f->next[f->next_count++] = r * port_cols + c;
+}
+
+// Moves from 'slot' to the sea. Inside a tile of open water the fewest moves
+// run straight to one of its edges and on from that edge slot.
+static inline int plan_exit(int slot) {
+    if (slot == planner.sea)
+        return 0;
+    int r = slot / port_cols, c = slot % port_cols;
+    int t = port_tile_dir[(r >> TILE_BITS) * port_tile_cols + (c >> TILE_BITS)];
+    int i = r & (TILE_SIZE - 1), j = c & (TILE_SIZE - 1);
+    if (t >= 0)
+        return planner.exit_dist[(long)t * TILE_CELLS + (i << TILE_BITS | j)];
+    const PlanEdges* e = &planner.open_exit[-1 - t];
+    if (e->top[0] == INT_MAX)
+        return INT_MAX;
+    int r1 = (r | (TILE_SIZE - 1)) < port_rows ? r | (TILE_SIZE - 1) : port_rows - 1;
+    int c1 = (c | (TILE_SIZE - 1)) < port_cols ? c | (TILE_SIZE - 1) : port_cols - 1;
+    int d = e->top[j] + i, x;
+    if ((x = e->bottom[j] + r1 - r) < d)
+        d = x;
+    if ((x = e->left[i] + j) < d)
+        d = x;
+    if ((x = e->right[i] + c1 - c) < d)
+        d = x;
+    return d;
+}
+
+// Compute the layout heuristic and reset the reservations, -1 if out of memory
+int plan_init() {
+    size_t slots = (size_t)port_tile_count * TILE_CELLS;
+    planner.sea = (int)((size_t)port_rows * port_cols);
+    planner.exit_dist = (int*)arena_alloc(slots * sizeof(int));
+    planner.open_exit = (PlanEdges*)arena_alloc(port_open_count * sizeof(PlanEdges));
+    PlanFlood f = {0};
+    f.pages = (int**)calloc(port_open_count + 1, sizeof(int*));
+    f.left = (int*)malloc((port_open_count + 1) * sizeof(int));
+    f.failed = !planner.exit_dist || !planner.open_exit || !f.pages || !f.left;
+    if (!f.failed) {
+        for (size_t i = 0; i < slots; i++)
+            planner.exit_dist[i] = INT_MAX;
+        for (int o = 0; o < port_open_count; o++) {
+            f.left[o] = -1;
+            for (int k = 0; k < TILE_SIZE; k++)
+                planner.open_exit[o].top[k] = planner.open_exit[o].bottom[k] =
+                    planner.open_exit[o].left[k] = planner.open_exit[o].right[k] = INT_MAX;
+        }
+        for (int c = 0; c < port_cols; c++)
+            plan_flood_reach(&f, port_rows - 1, c, 1);
+    }
+    for (int d = 1; f.next_count > 0 && !f.failed; d++) {
+        int* swap = f.cur;
+        long cap = f.cur_cap;
+        f.cur = f.next;
+        f.cur_cap = f.next_cap;
+        f.cur_count = f.next_count;
+        f.next = swap;
+        f.next_cap = cap;
+        f.next_count = 0;
+        for (long k = 0; k < f.cur_count && !f.failed; k++) {
+            int r = f.cur[k] / port_cols, c = f.cur[k] % port_cols;
+            if (r > 0) plan_flood_reach(&f, r - 1, c, d + 1);
+            if (r + 1 < port_rows) plan_flood_reach(&f, r + 1, c, d + 1);
+            if (c > 0) plan_flood_reach(&f, r, c - 1, d + 1);
+            if (c + 1 < port_cols) plan_flood_reach(&f, r, c + 1, d + 1);
+        }
+    }
+    for (int o = 0; f.pages && o < port_open_count; o++)
+        free(f.pages[o]);
+    free(f.pages);
+    free(f.left);
+    free(f.cur);
+    free(f.next);
+    if (f.failed)
+        return -1;
+    free(planner.resv);
+    planner.resv_cap = 4096;
+    planner.resv = (Reservation*)calloc(planner.resv_cap, sizeof(Reservation));
+    if (!planner.resv)
+        return -1;
+    planner.resv_used = 0;
+    planner.now = planner.latest = 0;
+    planner.plans = planner.replans = planner.expansions = planner.seconds = planner.delay = planner.ways_held = 0;
+    return 0;
+}
+
+// Free the search buffers and the reservation table
+void plan_free() {
+    free(planner.resv);
+    free(planner.visited);
+    free(planner.nodes);
+    free(planner.heap);
+    memset(&planner, 0, sizeof(planner));
+}
+
+// Seconds from 'second' until the berth of 'yacht' at 'slot' is no longer booked
+// by another yacht, 0 if it is free from 'second' on
+static int plan_berth_busy(const Yacht* yacht, int slot, uint64_t second) {
+    int slots_length = ceil((double)yacht->length / SLOT_SIZE);
+    int slots_width = ceil((double)yacht->width / SLOT_SIZE);
+    // Counts down with t + 1 so that second == 0 does not wrap
+    for (uint64_t t = planner.latest + 1; t > second; t--)
+        for (int i = 0; i < slots_length; i++)
+            for (int j = 0; j < slots_width; j++) {
+                int holder = resv_get(t - 1, slot + i * port_cols + j);
+                if (holder && holder != yacht->id)
+                    return (int)(t - second);
+            }
+    return 0;
+}
+
+// Whether the berth of 'yacht' at 'slot' (its own slots) touches water connected
+// to the sea. A yacht boxed in by others cannot move until one of them leaves, so
+// its manoeuvre is not searched for.
+static int plan_berth_open(const Yacht* yacht, int slot) {
+    int r = slot / port_cols, c = slot % port_cols;
+    int slots_length = ceil((double)yacht->length / SLOT_SIZE);
+    int slots_width = ceil((double)yacht->width / SLOT_SIZE);
+    if (r + slots_length >= port_rows || berth_reachable(r, c))
+        return 1;
+    for (int i = r - 1; i <= r + slots_length; i++)
+        for (int j = c - 1; j <= c + slots_width; j++) {
+            int on_edge_row = i == r - 1 || i == r + slots_length, on_edge_col = j == c - 1 || j == c + slots_width;
+            if (i < 0 || j < 0 || i >= port_rows || j >= port_cols || on_edge_row == on_edge_col)
+                continue;
+            // Water freed earlier in the same batch is not labelled yet: let the search decide
+            if (berth_reachable(i, j))
+                return 1;
+            int n = reach_node(i, j);
+            if (reach_water(n) && atomic_load(&reach_label[n]) < 0)
+                return 1;
+        }
+    return 0;
+}
+
+// Heuristic: moves from 'slot' to the goal of the plan (the sea when outbound)
+static inline int plan_h(int slot, int goal) {
+    if (goal == planner.sea)
+        return plan_exit(slot);
+    if (slot == planner.sea)
+        return plan_exit(goal);
+    int dr = abs(slot / port_cols - goal / port_cols), dc = abs(slot % port_cols - goal % port_cols);
+    int dx = abs(plan_exit(slot) - plan_exit(goal));
+    return dr + dc > dx ? dr + dc : dx;
+}
+
+// Mark (hold > 0) or unmark the way out of the berth at 'slot': the layout path
+// of steepest descent of exit_dist, which ties resolve the same way every time.
+// Free slots on it are written as -4, so no yacht docks there, and slots taken
+// by other yachts turn to -4 when those leave. Returns the slots on the path.
+static int plan_keep_clear(const Yacht* yacht, int slot, int hold) {
+    int count = 0;
+    int d;
+    while (slot != planner.sea && (d = plan_exit(slot)) != INT_MAX) {
+        PortSlot* cell = &SLOT(slot);
+        int v = atomic_load(&cell->occupied);
+        if (v != yacht->id) {
+            // Open water is one shared page and never taken, nothing to hold there
+            if (cell->base != -5)
+                cell->keep_clear += hold;
+            if (hold > 0 && (v == -1 || v == -3))
+                set_cells(slot / port_cols, slot % port_cols, 1, 1, -4);
+            else if (hold < 0 && v == -4 && cell->keep_clear == 0)
+                set_cells(slot / port_cols, slot % port_cols, 1, 1, 0);
+            count++;
+        }
+        if (d == 1)
+            break;
+        int r = slot / port_cols, c = slot % port_cols;
+        int nb[4] = {r + 1 < port_rows ? slot + port_cols : -1, c > 0 ? slot - 1 : -1,
+                     c + 1 < port_cols ? slot + 1 : -1, r > 0 ? slot - port_cols : -1};
+        int next = -1;
+        for (int k = 0; k < 4 && next < 0; k++)
+            if (nb[k] >= 0 && plan_exit(nb[k]) == d - 1)
+                next = nb[k];
+        slot = next;
+    }
+    return count;
+}
+
+// Estimated length of a plan through 'slot' reached after g seconds, given that
+// the goal cannot be reached before 'earliest'
+static inline int plan_f(int g, int slot, int goal, int earliest) {
+    int f = g + plan_h(slot, goal);
+    return f > earliest ? f : earliest;
+}
+
+// Plan and reserve a manoeuvre of 'yacht' starting at 'second': outbound from
+// 'slot' to the sea, or inbound from the sea to its berth at 'slot'. Returns the
+// seconds under way and stores those lost to other yachts in 'delay', -1 if no
+// path was found within the budget.
+int plan_path(const Yacht* yacht, int outbound, int slot, uint64_t second, int* delay) {
+    int start = outbound ? slot : planner.sea, goal = outbound ? planner.sea : slot;
+    if (second > planner.now) {
+        planner.now = second;
+        if (planner.latest < second)
+            planner.latest = second;
+    }
+    if (!plan_berth_open(yacht, slot))
+        return -1;
+    // An inbound yacht cannot arrive before the yachts booked through its berth have passed
+    int earliest = outbound ? 0 : plan_berth_busy(yacht, slot, second);
+    int free_flow = plan_h(start, goal);
+    int horizon = (free_flow > earliest ? free_flow : earliest) + PLAN_SLACK;
+    planner.stamp++;
+    planner.visited_used = 0;
+    planner.node_count = planner.heap_size = 0;
+    plan_visit(0, start);
+    plan_push(start, 0, free_flow > earliest ? free_flow : earliest, -1);
+
+    int found = -1;
+    for (long expanded = 0; planner.heap_size > 0 && expanded < PLAN_MAX_EXPANSIONS; expanded++) {
+        int n = plan_pop();
+        PlanNode node = planner.nodes[n];
+        planner.expansions++;
+        if (node.slot == goal && node.g >= earliest) {
+            found = n;
+            break;
+        }
+        if (node.g >= horizon)
+            continue;
+        uint64_t t = second + node.g + 1;
+        int next[5], count = 0;
+        if (node.slot == planner.sea) {
+            // Only inbound plans start at sea: wait there or enter any slot of the last row
+            next[count++] = planner.sea;
+            for (int c = 0; c < port_cols; c++) {
+                int s = (port_rows - 1) * port_cols + c;
+                if (plan_exit(s) != INT_MAX && plan_h(s, goal) + node.g + 1 <= horizon) {
+                    int v = atomic_load(&SLOT(s).occupied);
+                    if ((is_water(v) || v == yacht->id) && !resv_get(t, s) && plan_visit(node.g + 1, s))
+                        plan_push(s, node.g + 1, plan_f(node.g + 1, s, goal, earliest), n);
+                }
+            }
+        } else {
+            int r = node.slot / port_cols, c = node.slot % port_cols;
+            next[count++] = node.slot;
+            if (r > 0) next[count++] = node.slot - port_cols;
+            if (r + 1 < port_rows) next[count++] = node.slot + port_cols;
+            else if (outbound) next[count++] = planner.sea;
+            if (c > 0) next[count++] = node.slot - 1;
+            if (c + 1 < port_cols) next[count++] = node.slot + 1;
+        }
+        for (int k = 0; k < count; k++) {
+            int s = next[k];
+            if (s != planner.sea) {
+                int v = atomic_load(&SLOT(s).occupied);
+                if ((!is_water(v) && v != yacht->id) || resv_get(t, s))
+                    continue;
+                // Head-on swap with a yacht coming the other way
+                int other = node.slot != planner.sea && s != node.slot ? resv_get(t - 1, s) : 0;
+                if (other && resv_get(t, node.slot) == other)
+                    continue;
+            }
+            if (plan_visit(node.g + 1, s))
+                plan_push(s, node.g + 1, plan_f(node.g + 1, s, goal, earliest), n);
+        }
+    }
+    if (found < 0)
+        return -1;
+
+    for (int n = found; n >= 0; n = planner.nodes[n].parent)
+        if (planner.nodes[n].slot != planner.sea)
+            resv_put(second + planner.nodes[n].g, planner.nodes[n].slot, yacht->id);
+    int seconds = planner.nodes[found].g;
+    *delay = seconds - free_flow;
+    planner.plans++;
+    planner.seconds += seconds;
+    planner.delay += *delay;
+    return seconds;
+}
+
+// Random number generator of the engine (xorshift64*), independent of rand()
+uint32_t sim_rand() {
+    return rng_next(&engine.rng);
+}
+
+// Schedule an engine event 'delay' ticks from now
+static void engine_schedule(uint64_t delay, int type, void* arg, int data) {
+    wheel_add(&engine.wheel, engine.wheel.now + delay, type, arg, data);
+}
+
+// Reset the engine state and seed its random number generator
+void engine_init(uint64_t seed) {
+    memset(&engine, 0, sizeof(engine));
+    engine.rng = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    engine.next_yacht_id = 1;
+}
+
+// Create a new random yacht using the engine RNG
+static Yacht* engine_new_yacht() {
+    Yacht* yacht = yacht_alloc();
+    yacht->id = engine.next_yacht_id++;
+    yacht->length = sim_rand() % (YACHT_MAX_LENGTH - YACHT_MIN_LENGTH + 1) + YACHT_MIN_LENGTH;
+    yacht->width = sim_rand() % (YACHT_MAX_WIDTH - YACHT_MIN_WIDTH + 1) + YACHT_MIN_WIDTH;
+    yacht->oil_level = sim_rand() % 99 + 1;
+    yacht->waiting_time = 0;
+    yacht->extra_wait = 0;
+    yacht->spec_classes = 0;
+    yacht->dock_row = yacht->dock_col = -1;
+    yacht->crew_next = NULL;
+    yacht->batch_next = NULL;
+    yacht->way_out_held = 0;
+
+    atomic_store(&yacht->state, 1);   // Initial state: waiting
+    yacht->need_cleaning = draw_percent(sim_rand(), engine.demand[0]);
+    yacht->need_repair = draw_percent(sim_rand(), engine.demand[1]);
+    engine.live_yachts++;
+    return yacht;
+}
+
+// Yacht leaves the simulation
+static void engine_depart(Yacht* yacht) {
+    atomic_store(&yacht->state, 3); // Mark as leaving
+    trace_event(TR_DEPART, yacht, yacht->waiting_time, 0, 0);
+    record_departure(yacht);
+    engine.live_yachts--;
+    yacht_free(yacht);
+}
+
+// Crews: each crew is trained for one job (job_id) and serves the FIFO queue of
+// yachts waiting for that job. Cross-trained crews (engine.off_skill_rate > 0)
+// that find their own queue empty steal the oldest yacht waiting for the other
+// job and do it at the slower off-skill pace, so one job does not queue while
+// the crews of the other sit idle. Idle crews are kept as one bitmask per job,
+// so every dispatch is O(1) and picks the lowest idle crew, as a scan would.
+
+// Put a crew to work on a yacht
+static void engine_start_crew(int crew_idx, Yacht* yacht, int job) {
+    PortCrew* crew = &crews[crew_idx];
+    crew->yacht_id = yacht->id;
+    crew->task = job;
+    engine.idle_crews[crew->job_id - 1] &= ~(1u << crew_idx);
+    atomic_store(&crew->state, 1); // working
+    pthread_mutex_lock(&stats_mutex);
+    if (job == 1)
+        stats.total_cleanings++;
+    else
+        stats.total_repairs++;
+    pthread_mutex_unlock(&stats_mutex);
+    long wait = engine.wheel.now - yacht->crew_requested;
+    engine.crew_jobs++;
+    engine.crew_wait_ticks += wait;
+    if (wait > engine.crew_wait_max)
+        engine.crew_wait_max = wait;
+    uint64_t ticks = CREW_JOB_TIME * TICKS_PER_SEC;
+    if (job != crew->job_id) {
+        ticks = ticks * 100 / engine.off_skill_rate;
+        engine.crew_steals++;
+        engine.off_skill_ticks += ticks;
+    }
+    trace_event(TR_CREW_START, yacht, crew_idx, 0, job != crew->job_id);
+    engine_schedule(ticks, EV_CREW_DONE, yacht, crew_idx);
+}
+
+// Take the first yacht waiting for a job, NULL if there is none
+static Yacht* engine_crew_queue_pop(int job) {
+    Yacht* yacht = engine.crew_wait_head[job - 1];
+    if (yacht) {
+        engine.crew_wait_head[job - 1] = yacht->crew_next;
+        if (!yacht->crew_next)
+            engine.crew_wait_tail[job - 1] = NULL;
+    }
+    return yacht;
+}
+
+// A crew is free: give it the next yacht of its job, steal one of the other
+// job if it is cross-trained, or let it idle
+static void engine_crew_free(int crew_idx) {
+    PortCrew* crew = &crews[crew_idx];
+    int job = crew->job_id;
+    atomic_store(&crew->state, 0); // Go back to idle
+    crew->yacht_id = -1;
+    engine.idle_crews[job - 1] |= 1u << crew_idx;
+    Yacht* next = engine_crew_queue_pop(job);
+    if (!next && engine.off_skill_rate > 0 && (next = engine_crew_queue_pop(3 - job)))
+        job = 3 - job;
+    if (next)
+        engine_start_crew(crew_idx, next, job);
+}
+
+// Mark the crews that are not working as idle, after the crews were set up or loaded
+static void engine_index_crews() {
+    engine.idle_crews[0] = engine.idle_crews[1] = 0;
+    for (int i = 0; i < crew_count; i++)
+        if (atomic_load(&crews[i].state) == 0)
+            engine.idle_crews[crews[i].job_id - 1] |= 1u << i;
+}
+
+// Request a crew for a job (1=cleaning, 2=repair), waiting in FIFO order if all are busy
+static void engine_request_crew(Yacht* yacht, int job) {
+    yacht->crew_requested = engine.wheel.now;
+    unsigned idle = engine.idle_crews[job - 1];
+    if (!idle && engine.off_skill_rate > 0)
+        idle = engine.idle_crews[2 - job]; // Crews of the other job are idle only if its queue is empty
+    if (idle) {
+        engine_start_crew(__builtin_ctz(idle), yacht, job);
+        return;
+    }
+    yacht->crew_next = NULL;
+    if (engine.crew_wait_tail[job - 1])
+        engine.crew_wait_tail[job - 1]->crew_next = yacht;
+    else
+        engine.crew_wait_head[job - 1] = yacht;
+    engine.crew_wait_tail[job - 1] = yacht;
+}
+
+// Run the services a docked yacht still needs starting at 'job', then start its stay
+static void engine_service(Yacht* yacht, int job) {
+    if (job <= 1 && yacht->need_cleaning) {
+        engine_request_crew(yacht, 1);
+        return;
+    }
+    if (job <= 2 && yacht->need_repair) {
+        engine_request_crew(yacht, 2);
+        return;
+    }
+    // Docked: Stay for a random duration, then leave
+    int stay = sim_rand() % 20 + 20 + yacht->extra_wait;
+    engine_schedule((uint64_t)stay * TICKS_PER_SEC, EV_STAY_END, yacht, 0);
+}
+
+// Append a yacht to one of the batches of the current tick
+static void batch_push(Yacht** head, Yacht** tail, Yacht* yacht) {
+    yacht->batch_next = NULL;
+    if (*tail)
+        (*tail)->batch_next = yacht;
+    else
+        *head = yacht;
+    *tail = yacht;
+}
+
+// Take the first yacht of a batch, NULL if it is empty
+static Yacht* batch_pop(Yacht** head, Yacht** tail) {
+    Yacht* yacht = *head;
+    if (yacht) {
+        *head = yacht->batch_next;
+        if (!*head)
+            *tail = NULL;
+    }
+    return yacht;
+}
+
+// Sail a yacht between the sea and its berth: in (mode 0) or out (mode bit 0),
+// queueing it again at sea when mode bit 1 is set. Returns 0 if no path is free
+// yet; the manoeuvre is then tried again a second later.
+static int engine_manoeuvre(Yacht* yacht, int mode) {
+    uint64_t second = (engine.wheel.now + TICKS_PER_SEC - 1) / TICKS_PER_SEC;
+    int slot = yacht->dock_row * port_cols + yacht->dock_col, delay;
+    int seconds = plan_path(yacht, mode & 1, slot, second, &delay);
+    if (seconds < 0) {
+        // Boxed in: keep a way out clear so that new yachts do not take the berths
+        // freed in front of it
+        if (!yacht->way_out_held) {
+            plan_keep_clear(yacht, slot, 1);
+            yacht->way_out_held = 1;
+            planner.ways_held++;
+        }
+        planner.replans++;
+        engine_schedule(TICKS_PER_SEC, EV_REPLAN, yacht, mode);
+        return 0;
+    }
+    if (yacht->way_out_held) {
+        plan_keep_clear(yacht, slot, -1);
+        yacht->way_out_held = 0;
+        engine_reset_failures(); // Berths kept clear are free again
+    }
+    trace_event(TR_MANOEUVRE, yacht, mode & 1, seconds, delay);
+    engine_schedule((second + seconds) * TICKS_PER_SEC - engine.wheel.now, mode & 1 ? EV_AT_SEA : EV_BERTHED, yacht, mode);
+    return 1;
+}
+
+// Yacht leaves its berth: after its stay it departs, after refueling it queues
+// again at sea for the services it still needs. A yacht boxed in by others keeps
+// its berth until a path out is free. The caller holds port_mutex.
+static void engine_release(Yacht* yacht) {
+    int refueled = atomic_load(&yacht->state) == 4;
+    if (!engine_manoeuvre(yacht, 1 | (refueled && (yacht->need_cleaning || yacht->need_repair) ? 2 : 0)))
+        return;
+    vacate_slot(yacht);
+    atomic_store(&yacht->state, 3); // Leaving
+}
+
+// Yacht reached its berth: start its services or refuelling
+static void engine_berthed(Yacht* yacht) {
+    if (atomic_load(&yacht->state) == 2) {
+        engine_service(yacht, 1);
+        return;
+    }
+    pthread_mutex_lock(&stats_mutex);
+    stats.total_refuels++;
+    pthread_mutex_unlock(&stats_mutex);
+    if (atomic_load(&yacht->oil_level) < 100)
+        engine_schedule(REFUEL_STEP_MS / TICK_MS, EV_REFUEL_STEP, yacht, 0);
+    else
+        batch_push(&engine.release_head, &engine.release_tail, yacht);
+}
+
+// Try to dock a waiting yacht in the batch of the current tick
+static void engine_try_dock(Yacht* yacht) {
+    batch_push(&engine.dock_head, &engine.dock_tail, yacht);
+}
+
+// Dock a yacht of the current batch, retrying after one second if there is no
+// space. The grid only fills up during the matching pass, so a yacht at least
+// as large as one that already failed for the same berth classes is not searched
+// for again. The caller holds port_mutex.
+static void engine_dock(Yacht* yacht) {
+    int slots_length = ceil((double)yacht->length / SLOT_SIZE);
+    int slots_width = ceil((double)yacht->width / SLOT_SIZE);
+    int classes = dock_classes(yacht);
+    int failed = classes;
+    for (int k = 0; k < 2; k++)
+        if ((classes >> k) & 1)
+            for (int l = 1; l <= slots_length; l++)
+                if (engine.dock_fail[k][l] <= slots_width) {
+                    failed &= ~(1 << k);
+                    break;
+                }
+    if (failed == 0) {
+        engine.skipped_searches++;
+    } else {
+        place_yacht(yacht);
+        if (atomic_load(&yacht->state) == 1)
+            for (int k = 0; k < 2; k++)
+                if (((classes >> k) & 1) && slots_width < engine.dock_fail[k][slots_length])
+                    engine.dock_fail[k][slots_length] = slots_width;
+    }
+
+    int state = atomic_load(&yacht->state);
+    spec_want(yacht, state == 1);
+    if (state == 2 || state == 4) {
+        engine.waiting--;
+        engine.waiting_seconds -= yacht->waiting_time;
+        trace_event(TR_DOCK, yacht, yacht->dock_row, yacht->dock_col, state);
+        engine_manoeuvre(yacht, 0);
+    } else {
+        engine_schedule(TICKS_PER_SEC, EV_RETRY, yacht, 0);
+    }
+}
+
+// Forget the failed searches of the current batch
+static void engine_reset_failures() {
+    for (int k = 0; k < 2; k++)
+        for (int l = 0; l <= MAX_SLOTS_LENGTH; l++)
+            engine.dock_fail[k][l] = INT_MAX;
+}
+
+// Process the releases and docking attempts of the current tick under one lock:
+// apply all releases first and update the search index once, then run one
+// matching pass over the waiting yachts
+static void engine_flush_batch() {
+    if (!engine.release_head && !engine.dock_head)
+        return;
+    engine.batches++;
+    pthread_mutex_lock(&port_mutex);
+    grid_batch_begin();
+    Yacht* yacht;
+    while ((yacht = batch_pop(&engine.release_head, &engine.release_tail)) != NULL) {
+        engine.batch_releases++;
+        engine_release(yacht);
+    }
+    grid_batch_end();
+
+    engine_reset_failures();
+    while ((yacht = batch_pop(&engine.dock_head, &engine.dock_tail)) != NULL) {
+        engine.batch_docks++;
+        engine_dock(yacht);
+    }
+    pthread_mutex_unlock(&port_mutex);
+}
+
+// Dispatch one expired timer
+static void engine_fire(int type, void* arg, int data) {
+    Yacht* yacht = (Yacht*)arg;
+    switch (type) {
+    case EV_ARRIVAL:
+        if (engine.closing)
+            break; // No new yachts during shutdown
+        yacht = engine_new_yacht();
+        engine_schedule((sim_rand() % 3 + 1) * TICKS_PER_SEC, EV_ENQUEUE, yacht, 0); // Simulate arrival delay
+        engine_schedule(ARRIVAL_INTERVAL * TICKS_PER_SEC, EV_ARRIVAL, NULL, 0);
+        break;
+    case EV_ENQUEUE:
+        trace_event(TR_ENQUEUE, yacht, yacht->length, yacht->width, 0);
+        pthread_mutex_lock(&queue_mutex);
+        add_to_queue(yacht);
+        pthread_mutex_unlock(&queue_mutex);
+        engine.waiting++;
+        engine_try_dock(yacht);
+        break;
+    case EV_RETRY:
+        yacht->waiting_time++;
+        engine.waiting_seconds++;
+        update_queue_wait(yacht);
+        engine_try_dock(yacht);
+        break;
+    case EV_CREW_DONE:
+        trace_event(TR_CREW_DONE, yacht, data, 0, 0);
+        yacht->extra_wait += 5; // Add 5 seconds for the service
+        // The crew is not idle yet, so the yacht's next job cannot take it ahead of the queue
+        engine_service(yacht, crews[data].task + 1);
+        engine_crew_free(data);
+        break;
+    case EV_STAY_END:
+        batch_push(&engine.release_head, &engine.release_tail, yacht);
+        break;
+    case EV_REFUEL_STEP: {
+        int oil = atomic_load(&yacht->oil_level) + 1;
+        atomic_store(&yacht->oil_level, oil);
+        update_docked_oil(yacht);
+        if (oil < 100)
+            engine_schedule(REFUEL_STEP_MS / TICK_MS, EV_REFUEL_STEP, yacht, 0);
+        else
+            batch_push(&engine.release_head, &engine.release_tail, yacht);
+        break;
+    }
+    case EV_SAMPLE:
+        if (!metrics_out)
+            break; // What-if projections do not sample
+        sample_metrics();
+        engine_schedule((uint64_t)engine.sample_interval * TICKS_PER_SEC, EV_SAMPLE, NULL, 0);
+        break;
+    case EV_BERTHED:
+        engine_berthed(yacht);
+        break;
+    case EV_AT_SEA:
+        if (data & 2) {
+            atomic_store(&yacht->state, 1); // Set back to waiting (queue)
+            yacht->waiting_time = 0;
+            pthread_mutex_lock(&queue_mutex);
+            add_to_queue(yacht);
+            pthread_mutex_unlock(&queue_mutex);
+            engine.waiting++;
+            engine_try_dock(yacht);
+        } else {
+            engine_depart(yacht);
+        }
+        break;
+    case EV_REPLAN:
+        if (data & 1)
+            batch_push(&engine.release_head, &engine.release_tail, yacht); // Leaving goes through the release batch
+        else {
+            pthread_mutex_lock(&port_mutex); // May write slots kept clear
+            engine_manoeuvre(yacht, data);
+            pthread_mutex_unlock(&port_mutex);
+        }
+        break;
+    }
+}
+
+// Snapshots: the state of the engine between two ticks, compacted to what the
+// run needs to go on: the grid, yachts, pending timers, crews, queues, planner
+// reservations and statistics. Search indexes and channel labels are rebuilt
+// from the grid when loading, and yachts are referred to by their position in
+// the snapshot. Layout (host byte order): "YPSNAP06", the fields in the order
+// written by wal_snapshot, and an FNV-1a checksum of everything before it.
+typedef struct {
+    char* data;
+    size_t len, cap;
+    size_t pos;                   // Read position when loading
+} SnapBuf;
+
+static void snap_put(SnapBuf* b, const void* p, size_t len) {
+    if (b->len + len > b->cap) {
+        while (b->len + len > b->cap)
+            b->cap = b->cap ? b->cap * 2 : 1 << 16;
+        b->data = (char*)realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, p, len);
+    b->len += len;
+}
+
+// Read 'len' bytes, zero-filled past the end (the checksum catches short files)
+static void snap_get(SnapBuf* b, void* p, size_t len) {
+    size_t n = b->pos + len <= b->len ? len : b->pos < b->len ? b->len - b->pos : 0;
+    memcpy(p, b->data + b->pos, n);
+    memset((char*)p + n, 0, len - n);
+    b->pos += len;
+}
+
+// Run statistics carried over by snapshots
+#define SNAP_COUNTERS 18
+static long* const snap_counters[SNAP_COUNTERS] = {
+    &engine.batches, &engine.batch_releases, &engine.batch_docks, &engine.skipped_searches, &engine.wheel.fired,
+    &reach_updates, &reach_visited, &planner.plans, &planner.replans, &planner.expansions, &planner.ways_held, &planner.seconds, &planner.delay,
+    &engine.crew_steals, &engine.off_skill_ticks, &engine.crew_jobs, &engine.crew_wait_ticks, &engine.crew_wait_max
+};
+
+static uint64_t snap_checksum(const char* data, size_t len) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)data[i]) * 0x100000001B3ULL;
+    return h;
+}
+
+static int yacht_ptr_cmp(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)*(Yacht* const*)a, y = (uintptr_t)*(Yacht* const*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Position of a yacht in the sorted table of the snapshot, -1 for none
+static int snap_yacht_index(Yacht** yachts, int count, Yacht* yacht) {
+    if (!yacht)
+        return -1;
+    Yacht** found = (Yacht**)bsearch(&yacht, yachts, count, sizeof(Yacht*), yacht_ptr_cmp);
+    return found ? (int)(found - yachts) : -1;
+}
+
+// Serialize the engine state at the current tick
+static void snap_write_state(SnapBuf* b) {
+    TimingWheel* w = &engine.wheel;
+    snap_put(b, "YPSNAP06", 8);
+    snap_put(b, &w->now, sizeof(w->now));
+    snap_put(b, &port_rows, sizeof(port_rows));
+    snap_put(b, &port_cols, sizeof(port_cols));
+    snap_put(b, &port_dockable, sizeof(port_dockable));
+    snap_put(b, &engine.rng, sizeof(engine.rng));
+    snap_put(b, &engine.next_yacht_id, sizeof(int));
+    snap_put(b, &engine.live_yachts, sizeof(int));
+    snap_put(b, &engine.waiting, sizeof(int));
+    snap_put(b, &engine.waiting_seconds, sizeof(long));
+    snap_put(b, &engine.closing, sizeof(int));
+    snap_put(b, &engine.closed_tick, sizeof(uint64_t));
+    snap_put(b, &engine.closing_yachts, sizeof(int));
+    for (int i = 0; i < SNAP_COUNTERS; i++)
+        snap_put(b, snap_counters[i], sizeof(long));
+    snap_put(b, &reach_gains, sizeof(reach_gains));
+    snap_put(b, &w->max_pending, sizeof(int));
+    snap_put(b, &stats, sizeof(stats));
+
+    snap_put(b, &crew_count, sizeof(int));
+    for (int i = 0; i < crew_count; i++) {
+        int crew[5] = {crews[i].yacht_id, crews[i].crew_size, atomic_load(&crews[i].state), crews[i].job_id, crews[i].task};
+        snap_put(b, crew, sizeof(crew));
+    }
+    for (size_t i = 0; i < (size_t)port_tile_count * TILE_CELLS; i++) {
+        int cell[2] = {atomic_load(&port[i].occupied), port[i].keep_clear};
+        snap_put(b, cell, sizeof(cell));
+    }
+    snap_put(b, &queue_size, sizeof(int));
+    snap_put(b, queue, queue_size * sizeof(Yacht));
+    snap_put(b, &docked_size, sizeof(int));
+    snap_put(b, docked, docked_size * sizeof(Yacht));
+
+    // Every live yacht has a pending timer or waits for a crew
+    int cap = w->pending + 1, count = 0;
+    for (Yacht* y = engine.crew_wait_head[0]; y; y = y->crew_next)
+        cap++;
+    for (Yacht* y = engine.crew_wait_head[1]; y; y = y->crew_next)
+        cap++;
+    Yacht** yachts = (Yacht**)malloc(cap * sizeof(Yacht*));
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        for (int i = 0; i < WHEEL_SLOTS; i++)
+            for (Timer* t = w->slots[level][i]; t; t = t->next)
+                if (t->arg)
+                    yachts[count++] = (Yacht*)t->arg;
+    for (int job = 0; job < 2; job++)
+        for (Yacht* y = engine.crew_wait_head[job]; y; y = y->crew_next)
+            yachts[count++] = y;
+    qsort(yachts, count, sizeof(Yacht*), yacht_ptr_cmp);
+    int unique = 0;
+    for (int i = 0; i < count; i++)
+        if (unique == 0 || yachts[unique - 1] != yachts[i])
+            yachts[unique++] = yachts[i];
+    snap_put(b, &unique, sizeof(int));
+    for (int i = 0; i < unique; i++)
+        snap_put(b, yachts[i], sizeof(Yacht));
+
+    // Timer lists slot by slot, in list order, so they fire in the same order.
+    // Metrics samples are not part of the state; a resumed run samples anew.
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        for (int i = 0; i < WHEEL_SLOTS; i++) {
+            int n = 0;
+            for (Timer* t = w->slots[level][i]; t; t = t->next)
+                n += t->type != EV_SAMPLE;
+            if (n == 0)
+                continue;
+            int head[3] = {level, i, n};
+            snap_put(b, head, sizeof(head));
+            for (Timer* t = w->slots[level][i]; t; t = t->next) {
+                if (t->type == EV_SAMPLE)
+                    continue;
+                int rec[3] = {t->type, t->data, snap_yacht_index(yachts, unique, (Yacht*)t->arg)};
+                snap_put(b, &t->expires, sizeof(t->expires));
+                snap_put(b, rec, sizeof(rec));
+            }
+        }
+    int end[3] = {-1, 0, 0};
+    snap_put(b, end, sizeof(end));
+    for (int job = 0; job < 2; job++) {
+        int n = 0;
+        for (Yacht* y = engine.crew_wait_head[job]; y; y = y->crew_next)
+            n++;
+        snap_put(b, &n, sizeof(n));
+        for (Yacht* y = engine.crew_wait_head[job]; y; y = y->crew_next) {
+            int index = snap_yacht_index(yachts, unique, y);
+            snap_put(b, &index, sizeof(index));
+        }
+    }
+    free(yachts);
+
+    snap_put(b, &planner.now, sizeof(planner.now));
+    snap_put(b, &planner.latest, sizeof(planner.latest));
+    int live = 0;
+    for (size_t i = 0; i < planner.resv_cap; i++)
+        live += planner.resv[i].key && (planner.resv[i].key >> 32) - 1 >= planner.now;
+    snap_put(b, &live, sizeof(live));
+    for (size_t i = 0; i < planner.resv_cap; i++)
+        if (planner.resv[i].key && (planner.resv[i].key >> 32) - 1 >= planner.now)
+            snap_put(b, &planner.resv[i], sizeof(Reservation));
+    // Where the anytime search of every footprint class goes on, which decides
+    // its spots under a position budget
+    snap_put(b, anytime_classes, sizeof(anytime_classes));
+
+    uint64_t sum = snap_checksum(b->data, b->len);
+    snap_put(b, &sum, sizeof(sum));
+}
+
+// Load the engine state of a snapshot into a freshly initialised engine and
+// port, returns 0 if the snapshot is damaged or was taken of another port
+static int snap_read_state(SnapBuf* b) {
+    uint64_t sum;
+    if (b->len < 8 + sizeof(sum) || memcmp(b->data, "YPSNAP06", 8) != 0)
+        return 0;
+    memcpy(&sum, b->data + b->len - sizeof(sum), sizeof(sum));
+    if (sum != snap_checksum(b->data, b->len - sizeof(sum)))
+        return 0;
+    TimingWheel* w = &engine.wheel;
+    int rows, cols, dockable;
+    b->pos = 8;
+    snap_get(b, &w->now, sizeof(w->now));
+    snap_get(b, &rows, sizeof(rows));
+    snap_get(b, &cols, sizeof(cols));
+    snap_get(b, &dockable, sizeof(dockable));
+    if (rows != port_rows || cols != port_cols || dockable != port_dockable)
+        return 0;
+    snap_get(b, &engine.rng, sizeof(engine.rng));
+    snap_get(b, &engine.next_yacht_id, sizeof(int));
+    snap_get(b, &engine.live_yachts, sizeof(int));
+    snap_get(b, &engine.waiting, sizeof(int));
+    snap_get(b, &engine.waiting_seconds, sizeof(long));
+    snap_get(b, &engine.closing, sizeof(int));
+    snap_get(b, &engine.closed_tick, sizeof(uint64_t));
+    snap_get(b, &engine.closing_yachts, sizeof(int));
+    for (int i = 0; i < SNAP_COUNTERS; i++)
+        snap_get(b, snap_counters[i], sizeof(long));
+    unsigned long gains;
+    snap_get(b, &gains, sizeof(gains));
+    snap_get(b, &w->max_pending, sizeof(int));
+    snap_get(b, &stats, sizeof(stats));
+
+    snap_get(b, &crew_count, sizeof(int));
+    if (crew_count < 0 || crew_count > CREW_CAPACITY)
+        return 0;
+    for (int i = 0; i < crew_count; i++) {
+        int crew[5];
+        snap_get(b, crew, sizeof(crew));
+        crews[i].id = i;
+        crews[i].yacht_id = crew[0];
+        crews[i].crew_size = crew[1];
+        atomic_store(&crews[i].state, crew[2]);
+        crews[i].job_id = crew[3];
+        crews[i].task = crew[4];
+        if (crew[3] < 1 || crew[3] > 2 || crew[4] < 1 || crew[4] > 2)
+            return 0;
+    }
+    for (size_t i = 0; i < (size_t)port_tile_count * TILE_CELLS; i++) {
+        int cell[2];
+        snap_get(b, cell, sizeof(cell));
+        atomic_store(&port[i].occupied, cell[0]);
+        port[i].keep_clear = cell[1];
+    }
+    snap_get(b, &queue_size, sizeof(int));
+    if (queue_size < 0 || queue_size > MAX_QUEUE)
+        return 0;
+    snap_get(b, queue, queue_size * sizeof(Yacht));
+    snap_get(b, &docked_size, sizeof(int));
+    if (docked_size < 0 || docked_size > MAX_DOCKED)
+        return 0;
+    snap_get(b, docked, docked_size * sizeof(Yacht));
+
+    int count;
+    snap_get(b, &count, sizeof(count));
+    if (count < 0)
+        return 0;
+    Yacht** yachts = (Yacht**)malloc((count + 1) * sizeof(Yacht*));
+    for (int i = 0; i < count; i++) {
+        yachts[i] = yacht_alloc();
+        snap_get(b, yachts[i], sizeof(Yacht));
+        yachts[i]->crew_next = yachts[i]->batch_next = NULL;
+        yachts[i]->spec_classes = 0; // Speculation starts with no wanted classes
+    }
+    int ok = 1;
+    while (ok) {
+        int head[3];
+        snap_get(b, head, sizeof(head));
+        if (head[0] < 0)
+            break;
+        if (head[0] >= WHEEL_LEVELS || head[1] < 0 || head[1] >= WHEEL_SLOTS) {
+            ok = 0;
+            break;
+        }
+        Timer** tail = &w->slots[head[0]][head[1]];
+        for (int i = 0; i < head[2] && ok; i++) {
+            Timer* t = timer_alloc(w);
+            int rec[3];
+            snap_get(b, &t->expires, sizeof(t->expires));
+            snap_get(b, rec, sizeof(rec));
+            ok = rec[2] >= -1 && rec[2] < count;
+            t->type = rec[0];
+            t->data = rec[1];
+            t->arg = rec[2] >= 0 ? yachts[rec[2]] : NULL;
+            t->next = NULL;
+            *tail = t;
+            tail = &t->next;
+            w->pending++;
+        }
+    }
+    for (int job = 0; job < 2 && ok; job++) {
+        int n, index;
+        snap_get(b, &n, sizeof(n));
+        for (int i = 0; i < n && ok; i++) {
+            snap_get(b, &index, sizeof(index));
+            ok = index >= 0 && index < count;
+            if (!ok)
+                break;
+            Yacht* y = yachts[index];
+            if (engine.crew_wait_tail[job])
+                engine.crew_wait_tail[job]->crew_next = y;
+            else
+                engine.crew_wait_head[job] = y;
+            engine.crew_wait_tail[job] = y;
+        }
+    }
+    free(yachts);
+    if (!ok)
+        return 0;
+
+    uint64_t now, latest;
+    int live;
+    snap_get(b, &now, sizeof(now));
+    snap_get(b, &latest, sizeof(latest));
+    snap_get(b, &live, sizeof(live));
+    planner.now = now;
+    for (int i = 0; i < live; i++) {
+        Reservation r;
+        snap_get(b, &r, sizeof(r));
+        resv_put((r.key >> 32) - 1, (int)(uint32_t)r.key, r.yacht);
+    }
+    planner.latest = latest;
+    AnytimeClass classes[ORD_MAX_LENGTH + 1][ORD_MAX_WIDTH + 1][2];
+    snap_get(b, classes, sizeof(classes));
+
+    // Channel labels and search indexes follow the restored grid (their first,
+    // empty-port versions stay unused in the arena)
+    long updates = reach_updates, visited = reach_visited;
+    if (reach_init() < 0 || (allocator->init && allocator->init() < 0))
+        return 0;
+    reach_updates = updates;
+    reach_visited = visited;
+    reach_gains = gains;
+    memcpy(anytime_classes, classes, sizeof(classes));
+    engine_index_crews();
+    return b->pos + sizeof(sum) == b->len;
+}
+
+static void wal_path(char* out, size_t size, const char* name, uint64_t tick) {
+    if (name)
+        snprintf(out, size, "%s/%s", wal.dir, name);
+    else
+        snprintf(out, size, "%s/wal-%llu", wal.dir, (unsigned long long)tick);
+}
+
+// Write a whole file and sync it, returns 0 on failure
+static int wal_write_file(const char* path, const char* data, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return 0;
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) {
+            close(fd);
+            return 0;
+        }
+        data += n;
+        len -= n;
+    }
+    int ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// Sync the directory so that new and renamed files survive a crash
+static void wal_sync_dir() {
+    int fd = open(wal.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Create the empty log of the snapshot taken at 'tick'
+static OutStream* wal_create_log(uint64_t tick) {
+    char path[512], header[WAL_HEADER_SIZE];
+    wal_path(path, sizeof(path), NULL, tick);
+    memcpy(header, "YPWAL001", 8);
+    memcpy(header + 8, &tick, sizeof(tick));
+    if (!wal_write_file(path, header, sizeof(header))) {
+        perror(path);
+        return NULL;
+    }
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    OutStream* s = out_attach(fd, WAL_HEADER_SIZE);
+    s->sync = 1;
+    return s;
+}
+
+// Take a snapshot at the current tick and start its log. The new snapshot
+// replaces the old one by a rename once it and its empty log are on disk, so a
+// crash at any point leaves a whole snapshot with its log; the old log is
+// deleted last.
+static void wal_snapshot() {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint64_t tick = engine.wheel.now;
+    wal.next_snapshot = tick + (uint64_t)wal.snapshot_interval * TICKS_PER_SEC;
+    if (wal.out && tick == wal.log_tick)
+        return;
+
+    SnapBuf b = {0};
+    snap_write_state(&b);
+    char tmp[512], path[512], old[512];
+    wal_path(tmp, sizeof(tmp), "snapshot.tmp", 0);
+    wal_path(path, sizeof(path), "snapshot", 0);
+    wal_path(old, sizeof(old), NULL, wal.log_tick);
+    OutStream* log = wal_create_log(tick);
+    if (!log || !wal_write_file(tmp, b.data, b.len) || rename(tmp, path) < 0) {
+        perror("wal: snapshot"); // Keep logging on top of the previous snapshot
+        if (log) {
+            out_close(log);
+            wal_path(path, sizeof(path), NULL, tick);
+            unlink(path);
+        }
+        free(b.data);
+        return;
+    }
+    free(b.data);
+    wal_sync_dir();
+    if (wal.out) {
+        out_close(wal.out);
+        unlink(old);
+    }
+    wal.out = log;
+    wal.log_tick = tick;
+    wal.snapshots++;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    wal.snapshot_ms += (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+}
+
+// Read the log of the loaded snapshot for the replay and open it for appending
+// after its last whole record. A missing or damaged log counts as empty.
+static int wal_open_log() {
+    char path[512];
+    wal_path(path, sizeof(path), NULL, wal.log_tick);
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    struct stat st;
+    char header[WAL_HEADER_SIZE];
+    uint64_t tick;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < WAL_HEADER_SIZE ||
+        pread(fd, header, sizeof(header), 0) != sizeof(header) || memcmp(header, "YPWAL001", 8) != 0 ||
+        (memcpy(&tick, header + 8, sizeof(tick)), tick != wal.log_tick)) {
+        if (fd >= 0)
+            close(fd);
+        wal.out = wal_create_log(wal.log_tick);
+        return wal.out != NULL;
+    }
+    wal.replay_count = (st.st_size - WAL_HEADER_SIZE) / sizeof(TraceRecord); // A torn last record is dropped
+    off_t end = WAL_HEADER_SIZE + (off_t)wal.replay_count * sizeof(TraceRecord);
+    if (wal.replay_count > 0) {
+        wal.replay = (TraceRecord*)malloc(wal.replay_count * sizeof(TraceRecord));
+        if (pread(fd, wal.replay, end - WAL_HEADER_SIZE, WAL_HEADER_SIZE) != end - WAL_HEADER_SIZE) {
+            free(wal.replay);
+            wal.replay = NULL;
+            wal.replay_count = 0;
+            end = WAL_HEADER_SIZE;
+        }
+    }
+    if (ftruncate(fd, end) < 0)
+        perror(path);
+    wal.out = out_attach(fd, end);
+    wal.out->sync = 1;
+    return 1;
+}
+
+// Keep the write-ahead log and snapshots in 'dir', resuming the run saved there
+// if it holds one. Returns 0 if the saved run cannot be resumed.
+int wal_open(const char* dir, int snapshot_interval) {
+    memset(&wal, 0, sizeof(wal));
+    snprintf(wal.dir, sizeof(wal.dir), "%s", dir);
+    wal.snapshot_interval = snapshot_interval > 0 ? snapshot_interval : 1;
+    clock_gettime(CLOCK_MONOTONIC, &wal.last_commit);
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror(dir);
+        return 0;
+    }
+    wal.active = 1;
+    clock_gettime(CLOCK_MONOTONIC, &wal.recovery_start);
+
+    char path[512];
+    wal_path(path, sizeof(path), "snapshot", 0);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 1; // Nothing to resume: the first snapshot is taken when the run starts
+    SnapBuf b = {0};
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        b.cap = b.len = st.st_size;
+        b.data = (char*)malloc(b.len);
+        if (pread(fd, b.data, b.len, 0) != (ssize_t)b.len)
+            b.len = 0;
+    }
+    close(fd);
+    int ok = snap_read_state(&b);
+    free(b.data);
+    if (!ok) {
+        fprintf(stderr, "%s: damaged snapshot, or it was taken of a port of another size or layout\n", path);
+        return 0;
+    }
+    wal.recovered = 1;
+    wal.recovered_tick = wal.log_tick = engine.wheel.now;
+    wal.next_snapshot = engine.wheel.now + (uint64_t)wal.snapshot_interval * TICKS_PER_SEC;
+    if (!wal_open_log())
+        return 0;
+
+    // Logs of older snapshots left behind by a crash
+    DIR* d = opendir(dir);
+    char current[32];
+    snprintf(current, sizeof(current), "wal-%llu", (unsigned long long)wal.log_tick);
+    for (struct dirent* e; d && (e = readdir(d)) != NULL; ) {
+        if (strncmp(e->d_name, "wal-", 4) == 0 && strcmp(e->d_name, current) != 0) {
+            wal_path(path, sizeof(path), e->d_name, 0);
+            unlink(path);
+        }
+    }
+    if (d)
+        closedir(d);
+    return 1;
+}
+
+// First snapshot of a new run, taken once its first events are armed
+static void wal_begin() {
+    if (wal.active && !wal.recovered)
+        wal_snapshot();
+}
+
+// Stop logging once a write or sync of the log failed. Records after a lost one
+// could not be replayed, so the log ends there and the snapshot stays the last
+// point a crashed run can resume from.
+static int wal_failed() {
+    int err = wal.out ? atomic_load(&wal.out->error) : 0;
+    if (!err)
+        return 0;
+    fprintf(stderr, "wal: %s: %s, logging stopped\n", wal.dir, strerror(err));
+    out_close(wal.out);
+    wal.out = NULL;
+    wal.active = 0;
+    wal.failed = err;
+    return 1;
+}
+
+// Commit the records logged since the last commit as one group
+void wal_commit() {
+    if (!wal.active || wal.replay || !wal.out || wal.out->len == 0 || wal_failed())
+        return;
+    out_submit(wal.out);
+    wal.commits++;
+    clock_gettime(CLOCK_MONOTONIC, &wal.last_commit);
+}
+
+// Called between ticks: take a snapshot when one is due, otherwise commit the
+// records of the last WAL_COMMIT_MS as a group
+void wal_tick() {
+    if (!wal.active || wal.replay || wal_failed())
+        return;
+    if (engine.wheel.now >= wal.next_snapshot) {
+        wal_snapshot();
+        return;
+    }
+    if (!wal.out || wal.out->len == 0)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - wal.last_commit.tv_sec) * 1000 + (now.tv_nsec - wal.last_commit.tv_nsec) / 1000000 >= WAL_COMMIT_MS)
+        wal_commit();
+}
+
+// Run the engine through the log tail of a resumed run, at most up to 'end_tick'
+void wal_catch_up(uint64_t end_tick) {
+    if (!wal.recovered || wal.caught_up)
+        return;
+    struct timespec t1;
+    while (wal.replay && engine.wheel.now < end_tick)
+        wheel_advance(&engine.wheel);
+    if (wal.replay) { // Stopped early: the rest of the log is dropped
+        wal.out->offset = WAL_HEADER_SIZE + (off_t)wal.replay_pos * sizeof(TraceRecord);
+        if (ftruncate(wal.out->fd, wal.out->offset) < 0)
+            perror("wal");
+        free(wal.replay);
+        wal.replay = NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    wal.replayed_tick = engine.wheel.now;
+    wal.recovery_ms = (t1.tv_sec - wal.recovery_start.tv_sec) * 1e3 + (t1.tv_nsec - wal.recovery_start.tv_nsec) / 1e6;
+    wal.caught_up = 1;
+}
+
+// Commit the rest of the log and close it
+static void wal_close() {
+    if (!wal.active)
+        return;
+    out_close(wal.out);
+    wal.out = NULL;
+    wal.active = 0;
+}
+
+// Print the write-ahead log figures for the run summary
+void wal_report() {
+    if (wal.recovered)
+        printf("Recovery: resumed from the snapshot at %.1f s, replayed %ld of %ld log records up to %.1f s in %.1f ms%s\n",
+            (double)wal.recovered_tick / TICKS_PER_SEC, wal.replayed, wal.replay_count,
+            (double)wal.replayed_tick / TICKS_PER_SEC, wal.recovery_ms,
+            wal.diverged ? " (the run diverged from the log and went on from there)" : "");
+    if (wal.snapshots || wal.records)
+        printf("WAL: %ld records in %ld group commits (%ld syncs), %ld snapshots taking %.2f ms each\n",
+            wal.records, wal.commits, output.syncs, wal.snapshots, wal.snapshots ? wal.snapshot_ms / wal.snapshots : 0.0);
+    if (wal.failed)
+        printf("WAL: logging stopped after a failed write or sync (%s)\n", strerror(wal.failed));
+}
+
+// Trace index: the engine notes the first tick of every block of the trace and,
+// when a block is full, the hash of the trace so far and the distinct yachts in
+// the block. At the end of the run the (yacht, block) pairs are sorted into
+// per-yacht block lists, so a query reads one yacht's blocks or the blocks of a
+// time window instead of the whole trace. Two traces agree up to the end of a
+// block if their hashes there are equal, so their first difference is found by
+// a binary search over the hashes.
+static int trace_index_cmp_id(const void* a, const void* b) {
+    int32_t x = *(const int32_t*)a, y = *(const int32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int trace_index_cmp_posting(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Add the distinct yachts of the current block to the block lists
+static void trace_index_end_block(TraceIndexer* ix) {
+    qsort(ix->block_yachts, ix->block_len, sizeof(int32_t), trace_index_cmp_id);
+    for (int i = 0; i < ix->block_len; i++) {
+        int32_t id = ix->block_yachts[i];
+        if (id < 0 || (i > 0 && id == ix->block_yachts[i - 1]))
+            continue;
+        if (ix->posting_count == ix->posting_cap) {
+            ix->posting_cap = ix->posting_cap ? ix->posting_cap * 2 : 4096;
+            ix->postings = (uint64_t*)realloc(ix->postings, ix->posting_cap * sizeof(uint64_t));
+        }
+        ix->postings[ix->posting_count++] = (uint64_t)id << 32 | (uint64_t)(ix->blocks - 1);
+    }
+    ix->block_hashes[ix->blocks - 1] = ix->hash;
+    ix->block_len = 0;
+}
+
+// Index the next record of a trace
+void trace_index_add(TraceIndexer* ix, const TraceRecord* rec) {
+    if (ix->block_len == 0) {
+        if (ix->blocks == ix->block_cap) {
+            ix->block_cap = ix->block_cap ? ix->block_cap * 2 : 1024;
+            ix->block_ticks = (uint64_t*)realloc(ix->block_ticks, ix->block_cap * sizeof(uint64_t));
+            ix->block_hashes = (uint64_t*)realloc(ix->block_hashes, ix->block_cap * sizeof(uint64_t));
+        }
+        ix->block_ticks[ix->blocks++] = rec->tick;
+    }
+    const unsigned char* p = (const unsigned char*)rec;
+    uint64_t h = ix->records ? ix->hash : 0xCBF29CE484222325ULL; // FNV-1a, continued across records
+    for (size_t i = 0; i < sizeof(*rec); i++)
+        h = (h ^ p[i]) * 0x100000001B3ULL;
+    ix->hash = h;
+    ix->block_yachts[ix->block_len++] = rec->yacht_id;
+    ix->records++;
+    if (ix->block_len == TRACE_BLOCK_RECORDS)
+        trace_index_end_block(ix);
+}
+
+// Write the index of the records added so far to 'path', returns 0 on failure
+int trace_index_write(TraceIndexer* ix, const char* path) {
+    if (ix->block_len > 0)
+        trace_index_end_block(ix);
+    qsort(ix->postings, ix->posting_count, sizeof(uint64_t), trace_index_cmp_posting);
+
+    SnapBuf b = {0};
+    TraceIndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "YPTIDX02", 8);
+    h.block_records = TRACE_BLOCK_RECORDS;
+    h.records = ix->records;
+    h.blocks = ix->blocks;
+    h.postings = ix->posting_count;
+    snap_put(&b, &h, sizeof(h));
+    snap_put(&b, ix->block_ticks, ix->blocks * sizeof(uint64_t));
+    snap_put(&b, ix->block_hashes, ix->blocks * sizeof(uint64_t));
+    ix->yachts = 0;
+    for (long i = 0; i < ix->posting_count; i++) {
+        TraceIndexYacht y = {(int32_t)(ix->postings[i] >> 32), 1, (uint64_t)i};
+        while (i + 1 < ix->posting_count && ix->postings[i + 1] >> 32 == (uint64_t)(uint32_t)y.yacht_id) {
+            y.blocks++;
+            i++;
+        }
+        snap_put(&b, &y, sizeof(y));
+        ix->yachts++;
+    }
+    for (long i = 0; i < ix->posting_count; i++) {
+        uint32_t block = (uint32_t)ix->postings[i];
+        snap_put(&b, &block, sizeof(block));
+    }
+    ((TraceIndexHeader*)b.data)->yachts = ix->yachts;
+    int ok = wal_write_file(path, b.data, b.len);
+    free(b.data);
+    return ok;
+}
+
+// Free the memory of an index, keeping its counts for the summary
+void trace_index_free(TraceIndexer* ix) {
+    free(ix->block_ticks);
+    free(ix->block_hashes);
+    free(ix->postings);
+    ix->block_ticks = ix->block_hashes = NULL;
+    ix->postings = NULL;
+    ix->block_cap = ix->posting_cap = 0;
+}
+
+// Arm the first events of a run
+void engine_start() {
+    if (!wal.recovered) // A resumed run has its arrival timer
+        engine_schedule(0, EV_ARRIVAL, NULL, 0);
+    if (metrics_out) {
+        const char* header = "time,queue,docked,serviced,avg_wait,busy_crews,pending_timers\n";
+        out_write(metrics_out, header, strlen(header));
+        engine_schedule(0, EV_SAMPLE, NULL, 0);
+    }
+    if (trace_out)
+        out_write(trace_out, "YPTRACE1", 8);
+    wal_begin();
+}
+
+// Flush and close all bulk output of a run
+void engine_close_outputs() {
+    wal_close();
+    if (trace_out) {
+        out_close(trace_out);
+        if (!trace_index_write(&trace_index, trace_index_path))
+            perror(trace_index_path);
+        trace_index_free(&trace_index);
+    }
+    out_close(metrics_out);
+    trace_out = metrics_out = NULL;
+    output_stop();
+}
+
+// Run the engine up to 'end_tick', going through the log tail of a resumed run first
+void engine_advance(uint64_t end_tick) {
+    wal_catch_up(end_tick);
+    while (engine.wheel.now < end_tick) {
+        wheel_advance(&engine.wheel);
+        wal_tick();
+    }
+}
+
+// Stop arrivals. With 'drain', run on until the yachts in port have been
+// serviced and left, otherwise they are abandoned. Some yachts never leave (too
+// wide for a normal berth, they go from the fuel station back to the queue for
+// their services), so the drain also ends once no yacht left for DRAIN_STALL_SEC.
+#define DRAIN_STALL_SEC 3600
+void engine_shutdown(int drain) {
+    if (!engine.closing) {
+        engine.closing = 1;
+        engine.closed_tick = engine.wheel.now;
+        engine.closing_yachts = engine.live_yachts;
+    }
+    if (!drain)
+        return;
+    wal_catch_up(engine.wheel.now);
+    uint64_t last_departure = engine.wheel.now;
+    int left = engine.live_yachts;
+    while (engine.live_yachts > 0 && engine.wheel.now - last_departure < (uint64_t)DRAIN_STALL_SEC * TICKS_PER_SEC) {
+        wheel_advance(&engine.wheel);
+        wal_tick();
+        if (engine.live_yachts < left) {
+            left = engine.live_yachts;
+            last_departure = engine.wheel.now;
+        }
+    }
+    engine.drained = 1;
+}
+
+// Print how the run was shut down, if it was
+void engine_print_shutdown() {
+    if (!engine.closing)
+        return;
+    if (engine.drained)
+        printf("Shutdown: arrivals stopped at %.1f s, %d of %d yachts in port drained in %.1f s of simulated time, %d could not finish\n",
+            (double)engine.closed_tick / TICKS_PER_SEC, engine.closing_yachts - engine.live_yachts, engine.closing_yachts,
+            (double)(engine.wheel.now - engine.closed_tick) / TICKS_PER_SEC, engine.live_yachts);
+    else
+        printf("Shutdown: arrivals stopped at %.1f s, %d yachts in port abandoned\n",
+            (double)engine.closed_tick / TICKS_PER_SEC, engine.live_yachts);
+}
+
+// Print the statistics of a finished run that took 'wall' seconds
+void engine_print_summary(double wall) {
+    printf("Yachts serviced: %d | Avg wait: %.2f s | Max wait: %d s | Cleanings: %d | Repairs: %d | Refuels: %d\n",
+        stats.total_yachts_serviced,
+        stats.total_yachts_serviced ? (double)stats.total_waiting_time / stats.total_yachts_serviced : 0.0,
+        stats.max_waiting_time,
+        stats.total_cleanings,
+        stats.total_repairs,
+        stats.total_refuels);
+    printf("Events fired: %ld | Peak pending timers: %d | Yachts still in port: %d\n",
+        engine.wheel.fired, engine.wheel.max_pending, engine.live_yachts);
+    printf("Arena: %.1f MB used of %.1f MB (%s), %.1f MB overflow to heap\n",
+        arena.used / 1e6, arena.size / 1e6, arena_backing_name(), arena.overflow / 1e6);
+    if (allocator->report)
+        allocator->report();
+    printf("Channels: %ld grid writes, %.1f slots relabelled per write, %lu regions reopened\n",
+        reach_updates, reach_updates ? (double)reach_visited / reach_updates : 0.0, reach_gains);
+    printf("Manoeuvres: %ld planned, %ld retried (%ld boxed-in yachts had a way out kept clear), %.1f s under way of which %.1f s lost to other yachts, %.0f nodes expanded per plan\n",
+        planner.plans, planner.replans, planner.ways_held,
+        planner.plans ? (double)planner.seconds / planner.plans : 0.0,
+        planner.plans ? (double)planner.delay / planner.plans : 0.0,
+        planner.plans ? (double)planner.expansions / planner.plans : 0.0);
+    printf("Batches: %ld ticks, %ld releases, %ld docking attempts, %ld searches skipped\n",
+        engine.batches, engine.batch_releases, engine.batch_docks, engine.skipped_searches);
+    if (engine.crew_jobs > 0)
+        printf("Crews: %ld jobs, yachts waited %.2f s on average (at most %.1f s) for a crew\n",
+            engine.crew_jobs, (double)engine.crew_wait_ticks / engine.crew_jobs / TICKS_PER_SEC,
+            (double)engine.crew_wait_max / TICKS_PER_SEC);
+    if (engine.off_skill_rate > 0)
+        printf("Crews: %ld jobs done by a crew of the other job, %.1f s of off-skill work at %d%% pace\n",
+            engine.crew_steals, (double)engine.off_skill_ticks / TICKS_PER_SEC, engine.off_skill_rate);
+    if (lookahead.decisions > 0)
+        printf("Look-ahead: %ld decisions, %ld took another berth than the greedy one, %.1f rollouts and %.2f ms per decision, %ld cut short by the budget\n",
+            lookahead.decisions, lookahead.moved, (double)lookahead.rollouts / lookahead.decisions,
+            lookahead.wall_ms / lookahead.decisions, lookahead.cut_short);
+    if (spec.hits + spec.misses > 0)
+        printf("Speculation: %ld searches precomputed by workers, %ld done on the critical path\n", spec.hits, spec.misses);
+    engine_print_shutdown();
+    wal_report();
+    print_output_summary(wall);
+    cpu_report();
+}
+
+// Print the CPU time of every role that ran threads, and where it was pinned
+void cpu_report() {
+    double seconds[PORT_SIM_ROLES];
+    for (int i = 0; i < PORT_SIM_ROLES; i++)
+        seconds[i] = atomic_load(&thread_roles[i].exited_ns) / 1e9;
+    seconds[PORT_SIM_ENGINE] += thread_cpu_seconds(engine_thread);
+    for (int i = 0; i < spec.threads; i++)
+        seconds[PORT_SIM_SPECULATE] += thread_cpu_seconds(spec.tids[i]);
+    for (int i = 0; lookahead.candidates && i < lookahead.threads; i++)
+        seconds[PORT_SIM_LOOKAHEAD] += thread_cpu_seconds(lookahead.tids[i]);
+    if (output.active)
+        seconds[PORT_SIM_OUTPUT] += thread_cpu_seconds(output.thread);
+    printf("CPU:");
+    for (int i = 0, n = 0; i < PORT_SIM_ROLES; i++) {
+        ThreadRole* role = &thread_roles[i];
+        if (!role->threads)
+            continue;
+        printf("%s %s %.2f s", n++ ? "," : "", role_names[i], seconds[i]);
+        if (role->threads > 1)
+            printf(" in %d threads", role->threads);
+        if (role->pinned)
+            printf(" (CPUs %s)", role->list);
+    }
+    printf("\n");
+}
+
+// Stop everything a run started and free its memory: projections, workers,
+// outputs (flushed first), heap buffers and the arena
+void engine_free() {
+    whatif_abort();
+    lookahead_stop();
+    spec_stop();
+    engine_close_outputs();
+    free(trace_index_path);
+    trace_index_path = NULL;
+    plan_free();
+    free(grid_batch.rects);
+    memset(&grid_batch, 0, sizeof(grid_batch));
+    arena_destroy();
+    roles_release();
+}
+
+// What-if projections: the control command 'whatif CHANGE ARG [SECONDS]' forks
+// the live process. The fork shares all simulation state (globals, arena, heap)
+// copy-on-write, so the live run only pauses for fork() itself. The fork forks
+// once more, so two projections start from the same tick and random state and
+// run side by side: one unchanged and one under the hypothetical change. Both
+// fast-forward the engine without display or output, then the fork replies with
+// the projected waits of both and exits.
+#define WHATIF_HORIZON 3600           // Seconds projected when the command gives none
+#define WHATIF_MAX_RUNNING 4          // Projections running at the same time
+#define WHATIF_MAX_REGATTA 1000       // Largest regatta that can be projected
+
+enum {
+    WHATIF_CLOSE_ROW = 1,             // No yacht docks in row 'value' any more
+    WHATIF_ADD_CREW,                  // One more crew for job 'value' (1=cleaning, 2=repair)
+    WHATIF_REGATTA                    // 'value' large yachts arrive at once
+};
+
+typedef struct {
+    int kind;
+    int value;
+    long horizon;                     // Simulated seconds to project
+    char label[72];                   // "change=arg", names the changed branch in the reply
+} WhatIf;
+
+// Waits projected by one branch of a what-if
+typedef struct {
+    int serviced;                     // Yachts that left during the projection
+    long wait;                        // Seconds they had waited
+    int max_wait;                     // Longest of those waits
+    int waiting;                      // Yachts still waiting at the end
+    long waiting_seconds;             // Seconds those have waited so far
+} Projection;
+
+pid_t whatif_pids[WHATIF_MAX_RUNNING]; // Forked projections not reaped yet, 0 for a free entry
+int whatif_running;
+
+// Parse 'CHANGE ARG [SECONDS]', returns 0 if the command is not valid
+static int whatif_parse(const char* args, WhatIf* w) {
+    char change[32], arg[32];
+    w->horizon = WHATIF_HORIZON;
+    if (sscanf(args, "%31s %31s %ld", change, arg, &w->horizon) < 2 || w->horizon <= 0)
+        return 0;
+    snprintf(w->label, sizeof(w->label), "%s=%s", change, arg);
+    if (strcmp(change, "close-row") == 0) {
+        w->kind = WHATIF_CLOSE_ROW;
+        w->value = atoi(arg);
+        return w->value >= 0 && w->value < port_rows;
+    }
+    if (strcmp(change, "add-crew") == 0) {
+        w->kind = WHATIF_ADD_CREW;
+        w->value = strcmp(arg, "cleaning") == 0 ? 1 : strcmp(arg, "repair") == 0 ? 2 : 0;
+        return w->value && crew_count < CREW_CAPACITY;
+    }
+    if (strcmp(change, "regatta") == 0) {
+        w->kind = WHATIF_REGATTA;
+        w->value = atoi(arg);
+        return w->value > 0 && w->value <= WHATIF_MAX_REGATTA;
+    }
+    return 0;
+}
+
+// Apply a hypothetical change to the state of the fork
+static void whatif_apply(const WhatIf* w) {
+    if (w->kind == WHATIF_CLOSE_ROW) {
+        // Berths of the row stay navigable water; yachts docked there stay until they leave
+        pthread_mutex_lock(&port_mutex);
+        for (int c = 0; c < port_cols; c++) {
+            PortSlot* slot = &CELL(w->value, c);
+            if (slot->base == -2 || slot->base == -5)
+                continue;
+            slot->base = -4;
+            int v = atomic_load(&slot->occupied);
+            if (v == -1 || v == -3)
+                set_cells(w->value, c, 1, 1, -4);
+        }
+        pthread_mutex_unlock(&port_mutex);
+    } else if (w->kind == WHATIF_ADD_CREW) {
+        int i = crew_count++;
+        crews[i].id = i;
+        crews[i].yacht_id = -1;
+        crews[i].crew_size = 3;
+        atomic_store(&crews[i].state, 0);
+        crews[i].job_id = w->value;
+        crews[i].task = w->value;
+        engine_crew_free(i);
+    } else {
+        // The regular traffic keeps the random stream of the unchanged branch
+        uint64_t rng = engine.rng;
+        for (int i = 0; i < w->value; i++) {
+            Yacht* yacht = engine_new_yacht();
+            yacht->length = YACHT_MAX_LENGTH - sim_rand() % 11;
+            yacht->width = YACHT_MAX_WIDTH - sim_rand() % 11;
+            engine_schedule(TICKS_PER_SEC, EV_ENQUEUE, yacht, 0);
+        }
+        engine.rng = rng;
+    }
+}
+
+// Fast-forward the engine by 'horizon' simulated seconds and record the waits
+static void whatif_project(long horizon, Projection* p) {
+    memset(&stats, 0, sizeof(stats));
+    uint64_t end_tick = engine.wheel.now + (uint64_t)horizon * TICKS_PER_SEC;
+    while (engine.wheel.now < end_tick)
+        wheel_advance(&engine.wheel);
+    p->serviced = stats.total_yachts_serviced;
+    p->wait = stats.total_waiting_time;
+    p->max_wait = stats.max_waiting_time;
+    p->waiting = engine.waiting;
+    p->waiting_seconds = engine.waiting_seconds;
+}
+
+// Format one branch of a what-if reply
+static int whatif_format(char* out, size_t size, const char* name, const Projection* p) {
+    return snprintf(out, size, "%s serviced=%d avg_wait=%.2f max_wait=%d waiting=%d avg_waiting=%.2f\n",
+        name, p->serviced, p->serviced ? (double)p->wait / p->serviced : 0.0, p->max_wait,
+        p->waiting, p->waiting ? (double)p->waiting_seconds / p->waiting : 0.0);
+}
+
+// Body of the fork: project both branches, reply to client 'fd' and exit
+static void whatif_child(int fd, const WhatIf* w, const struct timespec* forked) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double paused = (now.tv_sec - forked->tv_sec) * 1e3 + (now.tv_nsec - forked->tv_nsec) / 1e6;
+    // Only the calling thread exists in a fork: no speculative or look-ahead workers,
+    // no output thread. Rollouts run on the calling thread.
+    spec.threads = 0;
+    lookahead.threads = 0;
+    pthread_mutex_init(&lookahead.mutex, NULL);
+    pthread_cond_init(&lookahead.cond, NULL);
+    pthread_cond_init(&lookahead.done, NULL);
+    trace_out = metrics_out = NULL;
+    wal.active = 0; // Projections are not logged
+    wal.replay = NULL;
+
+    Projection base, changed;
+    int pipefd[2];
+    pid_t pid = pipe(pipefd) == 0 ? fork() : -1;
+    if (pid == 0) {
+        close(pipefd[0]);
+        whatif_project(w->horizon, &base);
+        ssize_t unused = write(pipefd[1], &base, sizeof(base));
+        (void)unused;
+        _exit(0);
+    }
+    whatif_apply(w);
+    whatif_project(w->horizon, &changed);
+
+    char reply[512];
+    int n = snprintf(reply, sizeof(reply), "horizon=%ld paused_ms=%.2f\n", w->horizon, paused);
+    if (pid > 0) {
+        close(pipefd[1]);
+        if (read(pipefd[0], &base, sizeof(base)) == sizeof(base))
+            n += whatif_format(reply + n, sizeof(reply) - n, "unchanged", &base);
+        waitpid(pid, NULL, 0);
+    }
+    whatif_format(reply + n, sizeof(reply) - n, w->label, &changed);
+    ssize_t unused = write(fd, reply, strlen(reply));
+    (void)unused;
+    _exit(0);
+}
+
+// Start a what-if projection answering client 'fd'. Returns 0 with an error in
+// 'reply' if it could not be started; the fork replies otherwise.
+int whatif_start(int fd, const char* args, char* reply, size_t size) {
+    WhatIf w;
+    while (*args == ' ')
+        args++;
+    if (!whatif_parse(args, &w)) {
+        snprintf(reply, size, "error: usage: whatif close-row ROW | add-crew cleaning|repair | regatta YACHTS [SECONDS]\n");
+        return 0;
+    }
+    if (whatif_running >= WHATIF_MAX_RUNNING) {
+        snprintf(reply, size, "error: %d projections are running\n", whatif_running);
+        return 0;
+    }
+    struct timespec forked;
+    clock_gettime(CLOCK_MONOTONIC, &forked);
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0); // One process group with its second fork, so both can be stopped together
+        whatif_child(fd, &w, &forked);
+    }
+    if (pid < 0) {
+        snprintf(reply, size, "error: fork: %s\n", strerror(errno));
+        return 0;
+    }
+    setpgid(pid, pid);
+    for (int i = 0; i < WHATIF_MAX_RUNNING; i++)
+        if (!whatif_pids[i]) {
+            whatif_pids[i] = pid;
+            break;
+        }
+    whatif_running++;
+    return 1;
+}
+
+// Reap the projections that have replied
+void whatif_reap() {
+    for (int i = 0; i < WHATIF_MAX_RUNNING; i++)
+        if (whatif_pids[i] && waitpid(whatif_pids[i], NULL, WNOHANG) != 0) {
+            whatif_pids[i] = 0;
+            whatif_running--;
+        }
+}
+
+// Stop the running projections (their clients get no reply) and reap them
+void whatif_abort() {
+    for (int i = 0; i < WHATIF_MAX_RUNNING; i++)
+        if (whatif_pids[i]) {
+            kill(-whatif_pids[i], SIGKILL);
+            waitpid(whatif_pids[i], NULL, 0);
+            whatif_pids[i] = 0;
+        }
+    whatif_running = 0;
+}
+
+// Arena budget for the port: the populated tiles, the tiles of open water and
+// the dense indexes of the hist and pyramid backends
+size_t arena_port_bytes() {
+    int populated, open;
+    tiles_count(&populated, &open);
+    size_t bytes = (size_t)populated * TILE_CELLS * ARENA_BYTES_PER_CELL + (size_t)open * ARENA_BYTES_PER_OPEN_TILE;
+    if (allocator->find == hist_find_docking_spot || allocator->find == pyr_find_docking_spot)
+        bytes += (size_t)port_rows * port_cols * ARENA_DENSE_BYTES_PER_CELL;
+    return bytes + ARENA_BASE_BYTES;
+}
+
+// Map the arena, preferring explicit huge pages, then transparent huge pages
+int arena_init(size_t size, int want_huge) {
+    memset(&arena, 0, sizeof(arena));
+    size = (size + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+    arena.size = size;
+
+    if (want_huge) {
+        arena.base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (arena.base != MAP_FAILED) {
+            arena.backing = 2;
+            return 0;
+        }
+    }
+
+    // Over-map by one huge page so the arena can start on a huge page boundary
+    size_t map_size = size + ARENA_HUGE_PAGE;
+    char* raw = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) {
+        perror("arena_init");
+        memset(&arena, 0, sizeof(arena));
+        return -1;
+    }
+    char* base = (char*)(((uintptr_t)raw + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1));
+    if (base > raw)
+        munmap(raw, base - raw);
+    if (raw + map_size > base + size)
+        munmap(base + size, raw + map_size - (base + size));
+    arena.base = base;
+
+    if (want_huge && madvise(base, size, MADV_HUGEPAGE) == 0)
+        arena.backing = 1;
+    else
+        madvise(base, size, MADV_NOHUGEPAGE);
+    return 0;
+}
+
+// Free the allocations that overflowed to the heap
+static void arena_free_overflow() {
+    while (arena.overflow_blocks) {
+        void* next = *(void**)arena.overflow_blocks;
+        free(arena.overflow_blocks);
+        arena.overflow_blocks = next;
+    }
+    arena.overflow = 0;
+}
+
+// Unmap the arena and everything allocated from it
+void arena_destroy() {
+    arena_free_overflow();
+    if (arena.base)
+        munmap(arena.base, arena.size);
+    memset(&arena, 0, sizeof(arena));
+}
+
+// Empty the arena, keeping its mapping; the memory handed out again is zeroed
+void arena_reset() {
+    arena_free_overflow();
+    memset(arena.base, 0, arena.used);
+    arena.used = 0;
+}
+
+// Stop a run that needs more registry entries than memory allows; a run in
+// progress has no way back to its caller
+void arena_exhausted(const char* where) {
+    fprintf(stderr, "%s: out of memory after %zu bytes of the arena and %zu on the heap\n",
+        where, arena.used, arena.overflow);
+    abort();
+}
+
+// Allocate zeroed, cache-line aligned memory from the arena (heap if it is full),
+// NULL if the heap is out of memory too
+void* arena_alloc(size_t size) {
+    size = (size + 63) & ~(size_t)63;
+    if (arena.used + size > arena.size) {
+        void** block = (void**)aligned_alloc(64, size + 64);
+        if (!block)
+            return NULL;
+        arena.overflow += size;
+        memset(block, 0, size + 64);
+        *block = arena.overflow_blocks;
+        arena.overflow_blocks = block;
+        return (char*)block + 64;
+    }
+    void* p = arena.base + arena.used;
+    arena.used += size;
+    return p;
+}
+
+// Describe how the arena is backed
+const char* arena_backing_name() {
+    return arena.backing == 2 ? "MAP_HUGETLB" : arena.backing == 1 ? "transparent huge pages" : "normal pages";
+}
+
+// Take a yacht from the registry, growing it by a chunk from the arena when empty
+Yacht* yacht_alloc() {
+    if (!yacht_free_list) {
+        Yacht* chunk = (Yacht*)arena_alloc(REGISTRY_CHUNK * sizeof(Yacht));
+        if (!chunk)
+            arena_exhausted("yacht_alloc");
+        for (int i = 0; i < REGISTRY_CHUNK; i++) {
+            chunk[i].crew_next = yacht_free_list; // crew_next links free registry entries
+            yacht_free_list = &chunk[i];
+        }
+    }
+    Yacht* yacht = yacht_free_list;
+    yacht_free_list = yacht->crew_next;
+    return yacht;
+}
+
+// Return a yacht to the registry
+void yacht_free(Yacht* yacht) {
+    yacht->crew_next = yacht_free_list;
+    yacht_free_list = yacht;
+}
+
+// Initialize port slots with quay, oil pump, free or open water status, -1 if out of memory
+int init_port() {
+    queue = (Yacht*)arena_alloc(MAX_QUEUE * sizeof(Yacht));
+    docked = (Yacht*)arena_alloc(MAX_DOCKED * sizeof(Yacht));
+    if (!queue || !docked || tiles_init() < 0)
+        return -1;
+    queue_size = docked_size = 0;
+    yacht_free_list = NULL;
+
+    // The rows of a row of tiles all have the same layout, worked out once
+    int* base = (int*)malloc(port_cols * sizeof(int));
+    int* distance = (int*)malloc(port_cols * sizeof(int));
+    if (!base || !distance) {
+        free(base);
+        free(distance);
+        return -1;
+    }
+    for (int tr = 0; tr < port_tile_rows; tr++) {
+        int next_quay = 0;
+        int spacing = QUAY_LENGTH;
+        int last_quay_col = port_cols;
+        int dockable = 1;
+        for (int c = 0; c < port_cols; c++) {
+            if ((c & (TILE_SIZE - 1)) == 0)
+                dockable = tile_lookup(tr, c >> TILE_BITS) >= 0;
+
+            // Open water keeps the quay spacing of the rest of the row
+            if (!dockable) {
+                base[c] = -5; // open water
+                if (c == next_quay) {
+                    last_quay_col = c;
+                    next_quay += spacing;
+                    spacing++;
+                }
+            } else if (c == next_quay) {
+                base[c] = -2; // quay
+                last_quay_col = c;
+                next_quay += spacing;
+                spacing++;
+            } else {
+                if(last_quay_col > floor(port_cols/2)){
+                    base[c] = -3; // oil pump
+                }
+                else{
+                    base[c] = -1; // free
+                }
+            }
+        }
+
+        // Distance of every slot to the nearest quay of its row, in two passes
+        int last = -1;
+        for (int c = 0; c < port_cols; c++) {
+            if (base[c] == -2)
+                last = c;
+            distance[c] = last >= 0 ? c - last : port_cols * SLOT_SIZE;
+        }
+        last = -1;
+        for (int c = port_cols - 1; c >= 0; c--) {
+            if (base[c] == -2)
+                last = c;
+            if (last >= 0 && last - c < distance[c])
+                distance[c] = last - c;
+        }
+
+        // Open water keeps its shared page
+        for (int tc = 0; tc < port_tile_cols; tc++) {
+            if (tile_lookup(tr, tc) < 0)
+                continue;
+            for (int r = tr * TILE_SIZE; r < (tr + 1) * TILE_SIZE && r < port_rows; r++)
+                for (int c = tc * TILE_SIZE; c < (tc + 1) * TILE_SIZE && c < port_cols; c++) {
+                    CELL(r, c).base = base[c];
+                    atomic_store(&CELL(r, c).occupied, base[c]);
+                    CELL(r, c).quay_distance = distance[c];
+                }
+        }
+    }
+    free(base);
+    free(distance);
+    tiles_init_quays();
+    if (reach_init() < 0 || plan_init() < 0)
+        return -1;
+    return allocator->init ? allocator->init() : 0;
+}
+
+// Initialize cleaning and repair crews
+void init_crews() {
+    crew_count = MAX_CREWS;
+    for (int i = 0; i < MAX_CREWS; i++) {
+        crews[i].id = i; // Crew identifier
+        crews[i].yacht_id = -1; // No yacht assigned at start
+        crews[i].crew_size = 3;
+        atomic_store(&crews[i].state, 0); // 0=idle
+        crews[i].job_id = (i < MAX_CREWS/2) ? 1 : 2; // first half cleaning, rest repair
+        crews[i].task = crews[i].job_id;
+    }
+}
+
+// Embedding API (port_sim.h). The simulation state is the global state above,
+// so there is a single instance; creating or resetting it rebuilds the port in
+// the arena and re-arms the engine exactly as the command line program does.
+struct PortSim {
+    PortSimConfig config;
+    int started;                  // First events of the run armed
+};
+static PortSim port_sim;
+static int port_sim_alive;
+
+// Start a run from an empty port in the (empty) arena, -1 if out of memory
+static int port_sim_begin_run(uint64_t seed) {
+    memset(&stats, 0, sizeof(stats));
+    if (init_port() < 0)
+        return -1;
+    init_crews();
+    engine_init(seed);
+    engine.sample_interval = port_sim.config.sample_interval > 0 ? port_sim.config.sample_interval : 1;
+    engine.off_skill_rate = port_sim.config.cross_train;
+    engine.demand[0] = port_sim.config.demand[0];
+    engine.demand[1] = port_sim.config.demand[1];
+    engine_index_crews();
+    port_sim.started = 0;
+    return 0;
+}
+
+void port_sim_config_init(PortSimConfig* config) {
+    memset(config, 0, sizeof(*config));
+    config->rows = PORT_ROWS;
+    config->cols = PORT_COLS;
+    config->dockable = 100;
+    config->demand[0] = config->demand[1] = 10;
+    config->seed = (uint64_t)time(NULL);
+    config->allocator = "scan";
+    config->huge_pages = 1;
+    config->sample_interval = 1;
+    config->snapshot_interval = 3600;
+}
+
+PortSim* port_sim_create(const PortSimConfig* config) {
+    if (port_sim_alive) {
+        errno = EBUSY;
+        return NULL;
+    }
+    if (config->rows < YACHT_MAX_LENGTH / SLOT_SIZE || config->cols < YACHT_MAX_WIDTH / SLOT_SIZE + 1 ||
+        config->dockable < 1 || config->dockable > 100 || config->cross_train < 0 || config->cross_train > 100 ||
+        config->demand[0] < 0 || config->demand[0] > 100 || config->demand[1] < 0 || config->demand[1] > 100 ||
+        (config->wal_dir && config->search_budget_us > 0) || // A replay could not find the logged spots again
+        !select_allocator(config->allocator ? config->allocator : "scan")) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!roles_init(config)) {
+        roles_release();
+        errno = EINVAL;
+        return NULL;
+    }
+    port_rows = config->rows;
+    port_cols = config->cols;
+    port_dockable = config->dockable;
+    search_budget_cells = config->search_budget_cells;
+    search_budget_us = config->search_budget_us;
+    if (arena_init(arena_port_bytes(), config->huge_pages) < 0) {
+        roles_release();
+        return NULL;
+    }
+    port_sim.config = *config;
+    if (port_sim_begin_run(config->seed) < 0) {
+        plan_free();
+        arena_destroy();
+        roles_release();
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(&wal, 0, sizeof(wal));
+    memset(&trace_index, 0, sizeof(trace_index));
+    if (config->trace_path) {
+        free(trace_index_path);
+        trace_index_path = (char*)malloc(strlen(config->trace_path) + 5);
+        sprintf(trace_index_path, "%s.idx", config->trace_path);
+    }
+    if ((config->trace_path && !(trace_out = out_open(config->trace_path))) ||
+        (config->metrics_path && !(metrics_out = out_open(config->metrics_path))) ||
+        (config->wal_dir && !wal_open(config->wal_dir, config->snapshot_interval))) {
+        int err = errno;
+        engine_free();
+        errno = err;
+        return NULL;
+    }
+    spec_start(config->speculate);
+    lookahead_start(config->lookahead, config->lookahead_threads, config->lookahead_budget_ms);
+    port_sim_alive = 1;
+    return &port_sim;
+}
+
+void port_sim_run(PortSim* sim, double seconds) {
+    if (!sim->started) {
+        engine_start();
+        sim->started = 1;
+    }
+    engine_advance(engine.wheel.now + (uint64_t)llround(seconds * TICKS_PER_SEC));
+}
+
+void port_sim_stats(const PortSim* sim, PortSimStats* out) {
+    (void)sim;
+    memset(out, 0, sizeof(*out));
+    out->time = (double)engine.wheel.now / TICKS_PER_SEC;
+    out->serviced = stats.total_yachts_serviced;
+    out->total_wait = stats.total_waiting_time;
+    out->max_wait = stats.max_waiting_time;
+    out->cleanings = stats.total_cleanings;
+    out->repairs = stats.total_repairs;
+    out->refuels = stats.total_refuels;
+    out->waiting = engine.waiting;
+    out->waiting_seconds = engine.waiting_seconds;
+    out->in_port = engine.live_yachts;
+    out->events = engine.wheel.fired;
+}
+
+int port_sim_reset(PortSim* sim, uint64_t seed) {
+    if (trace_out || metrics_out || wal.active) {
+        errno = EINVAL;
+        return -1;
+    }
+    // The workers read the candidate lists, which are rebuilt in the arena
+    lookahead_stop();
+    spec_stop();
+    arena_reset();
+    if (port_sim_begin_run(seed) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    spec_start(sim->config.speculate);
+    lookahead_start(sim->config.lookahead, sim->config.lookahead_threads, sim->config.lookahead_budget_ms);
+    return 0;
+}
+
+void port_sim_drain(PortSim* sim) {
+    if (!sim->started) {
+        engine_start();
+        sim->started = 1;
+    }
+    engine_shutdown(1);
+}
+
+void port_sim_destroy(PortSim* sim) {
+    (void)sim;
+    engine_free();
+    port_sim_alive = 0;
+}
@@ -0,0 +1,450 @@
+#ifndef PORT_CORE_H
+#define PORT_CORE_H
+
+// Simulation model shared by the engine library (port_core.c), the ncurses
+// front end (port_simulation.c) and the trace tool (port_trace.c). Embedders use
+// the API in port_sim.h instead.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+#define PORT_ROWS 20       // Default number of rows in the port
+#define PORT_COLS 25       // Default number of columns in the port
+#define SLOT_SIZE 5        // Each slot represents 5 meters
+#define MAX_QUEUE 10       // Max yachts in the waiting queue
+#define MAX_DOCKED 20      // Max yachts in the docked list
+#define QUAY_LENGTH 3      // Amount of columns in quay
+#define CACHE_LINE 64      // Cache line size; independently written shared data is aligned to it
+#define MAX_CREWS 4        // 2 cleaning, 2 repair
+#define CREW_CAPACITY 8    // Crews including those added by what-if projections
+
+#define YACHT_MIN_LENGTH 10
+#define YACHT_MAX_LENGTH 50
+
+#define YACHT_MIN_WIDTH 5
+#define YACHT_MAX_WIDTH 30
+#define MAX_SLOTS_LENGTH ((YACHT_MAX_LENGTH + SLOT_SIZE - 1) / SLOT_SIZE) // Longest yacht in slots
+#define MAX_SLOTS_WIDTH ((YACHT_MAX_WIDTH + SLOT_SIZE - 1) / SLOT_SIZE)    // Widest yacht in slots
+
+#define TICK_MS 100                          // Resolution of the event-driven engine clock
+#define TICKS_PER_SEC (1000 / TICK_MS)       // Engine ticks per simulated second
+#define ARRIVAL_INTERVAL 5                   // Seconds between new yachts
+#define CREW_JOB_TIME 10                     // Seconds a crew works on a yacht
+#define REFUEL_STEP_MS 300                   // Time to refuel one percent of the tank
+
+#define WHEEL_BITS 6                         // Slots per timing wheel level = 2^WHEEL_BITS
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 5                       // 5 levels cover 2^30 ticks (~3.4 years at 100 ms)
+
+#define TILE_BITS 6                          // Tiles of the layout are 2^TILE_BITS slots square
+#define TILE_SIZE (1 << TILE_BITS)
+#define TILE_CELLS (TILE_SIZE * TILE_SIZE)
+
+#define ARENA_HUGE_PAGE (2UL << 20)          // Huge page size the arena is aligned to
+#define ARENA_BYTES_PER_CELL 128             // Arena budget per slot of a populated tile (grid and index structures)
+#define ARENA_BYTES_PER_OPEN_TILE 2048       // Arena budget per tile of open water
+#define ARENA_DENSE_BYTES_PER_CELL 8         // Extra budget per grid cell for the hist and pyramid backends
+#define ARENA_BASE_BYTES (64UL << 20)        // Arena budget independent of the grid size
+#define REGISTRY_CHUNK 4096                  // Yachts added to the registry when it runs out
+
+#define OUT_BUF_SIZE (1 << 20)               // Size of one output buffer
+#define OUT_BUFS 8                           // Output buffers shared by all streams (registered with io_uring)
+#define OUT_URING_ENTRIES 16                 // Submission queue depth of the output ring
+
+// Structure for a yacht
+typedef struct Yacht {
+    int id;                       // Unique ID
+    int length;                   // Length of the yacht in meters
+    int width;                    // Width of the yacht in meters
+    atomic_int state;             // State: 1=waiting, 2=docked, 3=leaving, 4=docked at fuel station
+    atomic_int oil_level;         // Level of oil in tank in percents
+    atomic_bool need_cleaning;    // Whether the yacht needs cleaning
+    atomic_bool need_repair;      // Whether the yacht needs repair
+    int waiting_time;             // Time spent waiting in seconds
+    int extra_wait;               // Seconds added to the stay by finished services (event engine)
+    int spec_classes;             // Berth classes counted as wanted for speculation (bit 0 free, bit 1 oil pump)
+    int dock_row;                 // Top-left slot of the berth, -1 when not docked
+    int dock_col;
+    struct Yacht* crew_next;      // Next yacht waiting for the same kind of crew (event engine)
+    struct Yacht* batch_next;     // Next yacht in the release or docking batch of the current tick (event engine)
+    int way_out_held;             // A way out of its berth is kept clear while it is boxed in (event engine)
+    uint64_t crew_requested;      // Tick the yacht asked for its current service (event engine)
+} Yacht;
+
+// Port slot structure
+typedef struct {
+    atomic_int occupied;          // ID of the occupying yacht, -1 if free, -2 if quay, -3 if oil pump, -4 if kept clear, -5 if open water
+    int base;                     // Layout value restored when the slot is released (-1, -2, -3 or -5)
+    int quay_distance;            // Slots to the nearest quay in the same row
+    int keep_clear;               // Boxed-in yachts whose way out crosses the slot; it is not a berth while > 0
+} PortSlot;
+
+// Tile of the layout with berths. Tiles without any are open water: yachts
+// sail through them but never dock there.
+typedef struct {
+    int row, col;                 // Tile coordinates (slot row and column / TILE_SIZE)
+    int min_quay_distance;        // Smallest quay distance of a yacht starting in it
+} PortTile;
+
+// Best spot for one berth class, r == -1 if none
+typedef struct {
+    int r, c;
+    int quay_distance;
+} DockSpot;
+
+// Docking search backend. Backends with index structures keep them up to date
+// through 'update', which is called after every change of the grid.
+typedef struct {
+    const char* name;
+    int (*init)();                // Build index structures for the current grid, -1 if out of memory, may be NULL
+    void (*update)(int r, int c, int slots_length, int slots_width); // Rectangle changed, may be NULL
+    void (*find)(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id);
+    void (*report)();             // Print backend statistics in the run summary, may be NULL
+    // Search several berth classes (bit 0 free, bit 1 oil pump) in one pass, may be NULL
+    void (*find_multi)(int slots_length, int slots_width, int classes, DockSpot* best);
+} DockAllocator;
+
+// Structure for a port crew, one cache line per crew
+typedef struct {
+    _Alignas(CACHE_LINE) int id;  // Unique ID of the crew
+    int yacht_id;                 // Yacht assigned to the crew, -1 if no yacht assigned
+    int crew_size;                // Number of crew members
+    atomic_int state;             // State: 0=idle, 1=working, 2=waiting for yacht
+    int job_id;                   // ID of the job assigned to the crew, 1 for cleaning, 2 for repairing
+    int task;                     // Job being done: job_id, or the other job when cross-trained
+} PortCrew;
+_Static_assert(sizeof(PortCrew) == CACHE_LINE, "each crew must occupy exactly one cache line");
+
+// Memory arena for the simulation state. It is one mapping backed by explicit
+// huge pages (MAP_HUGETLB) or transparent huge pages when available, so the grid
+// and the registry stay within a few TLB entries.
+typedef struct {
+    char* base;                   // Start of the mapping
+    size_t size;                  // Size of the mapping
+    size_t used;                  // Bytes handed out
+    size_t overflow;              // Bytes that did not fit and came from malloc
+    void* overflow_blocks;        // Those allocations, linked through their first cache line
+    int backing;                  // 2=MAP_HUGETLB, 1=transparent huge pages, 0=normal pages
+} Arena;
+// Statistics structure for the port
+typedef struct {
+    _Alignas(CACHE_LINE) int total_yachts_serviced; // Total number of yachts serviced
+    long total_waiting_time;     // Total waiting time of all yachts
+    int max_waiting_time;        // Maximum waiting time observed
+    int total_cleanings;         // Total number of cleanings performed
+    int total_repairs;           // Total number of repairs performed
+    int total_refuels;           // Total number of refuels performed
+} PortStats;
+
+// Event types handled by the event-driven engine
+enum {
+    EV_ARRIVAL = 1,     // Generate the next yacht
+    EV_ENQUEUE,         // Yacht reaches the port and joins the queue
+    EV_RETRY,           // Waiting yacht retries docking after one second
+    EV_CREW_DONE,       // Crew finished its job on a yacht
+    EV_STAY_END,        // Docked yacht leaves its berth
+    EV_REFUEL_STEP,     // Yacht at the fuel station gains one percent of oil
+    EV_SAMPLE,          // Append a time-series sample to the metrics output
+    EV_BERTHED,         // Yacht reached its berth after sailing in from the sea
+    EV_AT_SEA,          // Yacht left the port after sailing out from its berth
+    EV_REPLAN           // Retry planning a manoeuvre that found no path
+};
+
+// Pending timer in the timing wheel
+typedef struct Timer {
+    uint64_t expires;             // Absolute tick at which the timer fires
+    int type;                     // Event type (EV_*)
+    int data;                     // Extra event argument (crew index)
+    void* arg;                    // Event argument (yacht)
+    struct Timer* next;           // Next timer in the same slot
+} Timer;
+
+// Hierarchical timing wheel: level k slot i holds timers expiring within
+// 2^(WHEEL_BITS*(k+1)) ticks whose bits [WHEEL_BITS*k, WHEEL_BITS*(k+1)) equal i.
+// Timers are cascaded one level down when the lower level wraps around, so
+// insertion and expiry are O(1) amortised.
+typedef struct {
+    uint64_t now;                           // Current tick
+    Timer* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    Timer* free_list;                       // Recycled timer nodes
+    int pending;                            // Number of armed timers
+    int max_pending;                        // Peak number of armed timers
+    long fired;                             // Total number of expired timers
+} TimingWheel;
+
+// Trace record types
+enum {
+    TR_ENQUEUE = 1,     // a=length, b=width
+    TR_DOCK,            // a=row, b=col of the berth, c=state (2 or 4)
+    TR_RELEASE,         // a=row, b=col of the berth
+    TR_CREW_START,      // a=crew index, c=1 if the crew does the other job
+    TR_CREW_DONE,       // a=crew index
+    TR_DEPART,          // a=waiting time
+    TR_MANOEUVRE        // a=0 inbound / 1 outbound, b=seconds under way, c=seconds lost to other yachts
+};
+
+// Binary trace record, written in host byte order after an 8 byte "YPTRACE1" header
+typedef struct {
+    uint64_t tick;                // Engine tick of the event
+    int32_t yacht_id;             // Yacht the event refers to
+    int16_t type;                 // Record type (TR_*)
+    int16_t c;                    // Type specific argument
+    int32_t a;                    // Type specific argument
+    int32_t b;                    // Type specific argument
+} TraceRecord;
+
+// Trace index, written next to a trace FILE as FILE.idx (host byte order). The
+// records of the trace form blocks of TRACE_BLOCK_RECORDS; the index holds this
+// header, the tick of the first record of every block, the FNV-1a hash of the
+// trace up to the end of every block, the yacht table sorted by yacht ID, and
+// the blocks holding records of each yacht (uint32 block numbers).
+#define TRACE_BLOCK_RECORDS 1024
+typedef struct {
+    char magic[8];                // "YPTIDX02"
+    uint32_t block_records;       // Records per block
+    uint32_t reserved;
+    uint64_t records;             // Records in the trace
+    uint64_t blocks;
+    uint64_t yachts;
+    uint64_t postings;            // Block numbers of all yachts
+} TraceIndexHeader;
+
+typedef struct {
+    int32_t yacht_id;
+    uint32_t blocks;              // Blocks with records of the yacht
+    uint64_t first;               // Position of the first of them among the block numbers
+} TraceIndexYacht;
+
+// Trace index being built while a trace is written
+typedef struct {
+    uint64_t records;
+    uint64_t* block_ticks;        // Tick of the first record of every block
+    uint64_t* block_hashes;       // Hash of the records up to the end of every block
+    long blocks, block_cap;
+    uint64_t hash;                // Hash of the records so far
+    int32_t block_yachts[TRACE_BLOCK_RECORDS]; // Yachts of the records of the current block
+    int block_len;
+    uint64_t* postings;           // Yacht ID << 32 | block, one per yacht and block
+    long posting_count, posting_cap;
+    long yachts;                  // Yachts in the written index
+} TraceIndexer;
+
+// Output file fed through the output pipeline
+typedef struct {
+    int fd;                       // Destination file
+    off_t offset;                 // File offset of the current buffer
+    int buf;                      // Buffer being filled, -1 if none
+    size_t len;                   // Bytes in the current buffer
+    long bytes;                   // Total bytes accepted
+    int sync;                     // Durable: data is synced to disk after every write batch
+    atomic_int error;             // errno of the first write to the file that failed, 0 if none
+} OutStream;
+
+// Write request handed to the output thread
+typedef struct {
+    int fd;
+    off_t offset;
+    int buf;
+    size_t len;
+    int sync;                     // Sync the file once the batch is written
+    OutStream* stream;            // Stream the buffer belongs to, told about failed writes
+} OutRequest;
+
+// Minimal io_uring instance used by the output thread (raw syscalls, no liburing)
+typedef struct {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ptr;
+    void* cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+} OutRing;
+
+// Asynchronous output pipeline: the engine fills buffers, a single thread
+// writes them with batched io_uring submissions (or pwritev as a fallback)
+typedef struct {
+    int active;                   // Whether the output thread runs
+    int use_uring;                // 1 = io_uring, 0 = pwritev fallback
+    int stop;                     // Set to make the output thread exit once drained
+    pthread_t thread;
+    _Alignas(CACHE_LINE) pthread_mutex_t mutex; // Guards the fields up to the statistics
+    pthread_cond_t work_cond;     // Signalled when requests are queued or on stop
+    pthread_cond_t free_cond;     // Signalled when buffers are returned
+    char* bufs[OUT_BUFS];         // NULL for a buffer retired for lack of memory
+    int free_bufs[OUT_BUFS];      // Stack of free buffer indexes
+    int free_count;
+    int buf_count;                // Buffers not retired
+    OutRequest pending[OUT_BUFS]; // FIFO of filled buffers waiting to be written
+    int pending_head;
+    int pending_count;
+    int inflight;                 // Buffers currently being written by the output thread
+    OutRing ring;
+    // Written by the output thread only
+    _Alignas(CACHE_LINE) long bytes_written; // Statistics reported in the run summary
+    long write_calls;
+    long batches;
+    long syncs;                   // fdatasync calls for durable streams that succeeded
+    long failed_syncs;            // fdatasync calls that failed; the stream keeps the error
+    long failed_writes;           // Buffers that could not be written, even with pwrite
+    int error;                    // errno of the first of them
+    double busy_sec;              // Time the output thread spent writing
+    // Written by the engine only
+    _Alignas(CACHE_LINE) double stall_sec; // Time the engine waited for a free buffer
+    long dropped_bytes;           // Bytes not written because every buffer was retired
+} OutputPipeline;
+
+// State of the event-driven engine
+typedef struct {
+    TimingWheel wheel;
+    uint64_t rng;                 // xorshift64* state, so runs are reproducible from a seed
+    int next_yacht_id;            // ID for the next generated yacht
+    Yacht* crew_wait_head[2];     // Yachts waiting for a cleaning / repair crew
+    Yacht* crew_wait_tail[2];
+    unsigned idle_crews[2];       // Idle cleaning / repair crews, bit i for crews[i]
+    int off_skill_rate;           // Pace of a crew on the other job in percent, 0 if crews are not cross-trained
+    int demand[2];                // Percent of new yachts that need cleaning / repair
+    long crew_steals;             // Jobs done by a crew of the other job
+    long off_skill_ticks;         // Time those jobs took
+    long crew_jobs;               // Jobs started by crews
+    long crew_wait_ticks;         // Time yachts waited for those jobs to start
+    long crew_wait_max;           // Longest of those waits
+    int live_yachts;              // Yachts currently in the simulation
+    int waiting;                  // Yachts waiting to dock
+    long waiting_seconds;         // Seconds the waiting yachts have waited so far
+    int sample_interval;          // Seconds between metrics samples
+    Yacht* release_head;          // Yachts leaving their berth at the current tick
+    Yacht* release_tail;
+    Yacht* dock_head;             // Yachts trying to dock at the current tick
+    Yacht* dock_tail;
+    int dock_fail[2][MAX_SLOTS_LENGTH + 1]; // Narrowest width that found no berth, per class and length, in the current batch
+    long batches;                 // Ticks with at least one release or docking attempt
+    long batch_releases;          // Releases applied by batches
+    long batch_docks;             // Docking attempts made by batches
+    long skipped_searches;        // Docking attempts answered by an earlier failure of the same batch
+    int closing;                  // Arrivals stopped for shutdown
+    uint64_t closed_tick;         // Tick at which arrivals stopped
+    int closing_yachts;           // Yachts in port when arrivals stopped
+    int drained;                  // Whether those yachts were run until they left
+} Engine;
+
+// Shared state, defined in port_core.c
+extern Arena arena;
+extern int port_rows, port_cols;
+extern PortSlot* port;
+extern int port_dockable;
+extern PortTile* port_tiles;
+extern int port_tile_count;
+extern PortTile* port_open_tiles;
+extern int port_open_count;
+extern int port_tile_rows, port_tile_cols;
+extern int* port_tile_dir;
+extern PortSlot** port_pages;
+extern Yacht* queue;
+extern Yacht* docked;
+extern Yacht* yacht_free_list;
+extern PortCrew crews[CREW_CAPACITY];
+extern int crew_count;
+extern int queue_size, docked_size;
+extern pthread_mutex_t port_mutex, queue_mutex, docked_mutex, stats_mutex;
+extern PortStats stats;
+extern OutputPipeline output;
+extern OutStream* trace_out;
+extern OutStream* metrics_out;
+extern Engine engine;
+extern DockAllocator* allocator;
+extern const char* const role_names[];       // Names of the thread roles of port_sim.h
+extern long search_budget_cells, search_budget_us;
+// Slot (r, c), found through the page of its tile; open water slots all share
+// one page, which is never written
+#define CELL(r, c) port_pages[((r) >> TILE_BITS) * port_tile_cols + ((c) >> TILE_BITS)] \
+    [((r) & (TILE_SIZE - 1)) << TILE_BITS | ((c) & (TILE_SIZE - 1))]
+// Slot with row-major index idx
+#define SLOT(idx) CELL((int)((idx) / port_cols), (int)((idx) % port_cols))
+
+// Function prototypes
+void add_to_queue(Yacht* yacht);
+void update_queue_wait(Yacht* yacht);
+void update_docked_oil(Yacht* yacht);
+void record_departure(Yacht* yacht);
+void assign_to_port(Yacht* yacht);
+void release_slot(Yacht* yacht);
+void place_yacht(Yacht* yacht);
+void vacate_slot(Yacht* yacht);
+int dock_classes(const Yacht* yacht);
+int can_dock_here(int r, int c, int slots_length, int slots_width, int required_id);
+void scan_find_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id);
+void find_best_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id);
+void find_best_docking_spots(int slots_length, int slots_width, int classes, DockSpot* best);
+int select_allocator(const char* name);
+void set_cells(int r, int c, int slots_length, int slots_width, int value);
+void grid_batch_begin();
+void grid_batch_end();
+int reach_init();
+int plan_init();
+void plan_free();
+void reach_update(int r, int c, int slots_length, int slots_width);
+void spec_start(int threads);
+void spec_stop();
+void spec_want(Yacht* yacht, int waiting);
+void lookahead_start(int candidates, int threads, int budget_ms);
+void lookahead_stop();
+int wal_open(const char* dir, int snapshot_interval);
+void wal_catch_up(uint64_t end_tick);
+void wal_tick();
+void wal_commit();
+void wal_report();
+size_t arena_port_bytes();
+int arena_init(size_t size, int want_huge);
+void arena_destroy();
+void arena_reset();
+void* arena_alloc(size_t size); // NULL if the arena is full and the heap too
+void arena_exhausted(const char* where);
+const char* arena_backing_name();
+Yacht* yacht_alloc();
+void yacht_free(Yacht* yacht);
+int init_port();
+int tile_lookup(int tile_row, int tile_col);
+void init_crews();
+void wheel_add(TimingWheel* w, uint64_t expires, int type, void* arg, int data);
+void wheel_advance(TimingWheel* w);
+uint64_t wheel_next_expiry(TimingWheel* w);
+uint32_t sim_rand();
+void output_start();
+void output_stop();
+OutStream* out_open(const char* path);
+OutStream* out_attach(int fd, off_t offset);
+void out_write(OutStream* s, const void* data, size_t len);
+void out_close(OutStream* s);
+void trace_event(int type, Yacht* yacht, int a, int b, int c);
+void trace_index_add(TraceIndexer* ix, const TraceRecord* rec);
+int trace_index_write(TraceIndexer* ix, const char* path);
+void trace_index_free(TraceIndexer* ix);
+void print_output_summary(double wall);
+void engine_init(uint64_t seed);
+void engine_start();
+void engine_advance(uint64_t end_tick);
+void engine_close_outputs();
+void engine_shutdown(int drain);
+void engine_print_shutdown();
+void engine_print_summary(double wall);
+void engine_free();
+void cpu_report();
+int whatif_start(int fd, const char* args, char* reply, size_t size);
+void whatif_reap();
+void whatif_abort();
+
+#endif
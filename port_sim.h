@@ -0,0 +1,111 @@
+#ifndef PORT_SIM_H
+#define PORT_SIM_H
+
+// Embedding API of the yacht port simulation (libportsim). The library runs the
+// event-driven engine in-process without a terminal: create a simulation, run it
+// for some simulated time, read its statistics, and reset or destroy it.
+//
+// The engine keeps its state in the library, so one simulation can exist per
+// process at a time; port_sim_create() fails with EBUSY while another is alive.
+// Optimisers that evaluate runs in parallel need one process per simulation
+// (fork a worker per core, for example), not one thread per simulation.
+// Runs are independent: a created or reset simulation starts from an empty port,
+// and the same configuration and seed always produce the same run. The calls
+// are not thread-safe; call them from one thread at a time.
+
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define PORT_SIM_API __attribute__((visibility("default")))
+#else
+#define PORT_SIM_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Thread roles that can be pinned to CPUs. The engine role is the thread that
+// creates and runs the simulation; the others are threads of the library.
+enum {
+    PORT_SIM_ENGINE,              // Engine (and, in the program, the display and control socket)
+    PORT_SIM_SPECULATE,           // Speculative docking search workers
+    PORT_SIM_LOOKAHEAD,           // Look-ahead rollout workers
+    PORT_SIM_OUTPUT,              // Writer of traces, metrics and the write-ahead log
+    PORT_SIM_ROLES
+};
+
+// Configuration of a simulation, filled with defaults by port_sim_config_init()
+typedef struct {
+    int rows;                     // Rows of the port grid
+    int cols;                     // Columns of the port grid
+    int dockable;                 // Percent of the 64x64 tiles of the grid with berths, the rest is open water
+    uint64_t seed;                // Seed for the random number generator
+    const char* allocator;        // Docking search backend: scan, hist, pyramid, ordered, cached, tiles, anytime
+    long search_budget_cells;     // Slot positions an anytime search may examine, 0 for no limit
+    long search_budget_us;        // Wall time of an anytime search, 0 for no limit (not with wal_dir)
+    int huge_pages;               // Back simulation state with huge pages
+    int cross_train;              // Pace of a crew on the other job in percent of its own, 0 to keep crews to their job
+    int demand[2];                // Percent of arriving yachts that need cleaning / repair
+    int speculate;                // Worker threads precomputing docking spots, 0 for none
+    int lookahead;                // Berths weighed with rollouts per docking, 0 for the greedy rule
+    int lookahead_threads;        // Rollout worker threads besides the calling thread
+    int lookahead_budget_ms;      // Wall time per look-ahead decision, 0 for none (runs are only reproducible without)
+    const char* trace_path;       // Binary event trace, NULL for none
+    const char* metrics_path;     // Time-series samples as CSV, NULL for none
+    int sample_interval;          // Simulated seconds between metrics samples
+    const char* wal_dir;          // Write-ahead log and snapshots, NULL for none
+    int snapshot_interval;        // Simulated seconds between snapshots
+    const char* cpus[PORT_SIM_ROLES]; // CPU list per thread role (e.g. "2-5,8"), NULL to leave unpinned
+} PortSimConfig;
+
+// Statistics of a simulation so far
+typedef struct {
+    double time;                  // Simulated seconds
+    int serviced;                 // Yachts that left the port
+    long total_wait;              // Seconds those yachts waited to dock
+    int max_wait;                 // Longest of those waits
+    int cleanings;                // Cleaning jobs done
+    int repairs;                  // Repair jobs done
+    int refuels;                  // Yachts refuelled
+    int waiting;                  // Yachts waiting to dock
+    long waiting_seconds;         // Seconds the waiting yachts have waited so far
+    int in_port;                  // Yachts in the simulation (waiting, under way or docked)
+    long events;                  // Engine events fired
+} PortSimStats;
+
+typedef struct PortSim PortSim;
+
+// Fill 'config' with the defaults of the command line program
+PORT_SIM_API void port_sim_config_init(PortSimConfig* config);
+
+// Create a simulation, NULL with errno set on failure (EBUSY if one exists,
+// EINVAL for a bad configuration, ENOMEM if the port does not fit in memory, or
+// the error of opening an output file)
+PORT_SIM_API PortSim* port_sim_create(const PortSimConfig* config);
+
+// Advance the simulation by 'seconds' of simulated time, as fast as possible
+PORT_SIM_API void port_sim_run(PortSim* sim, double seconds);
+
+// Read the statistics of the run so far
+PORT_SIM_API void port_sim_stats(const PortSim* sim, PortSimStats* stats);
+
+// Stop arrivals and run until every yacht in port has been serviced and left.
+// Later runs stay without arrivals until the next reset.
+PORT_SIM_API void port_sim_drain(PortSim* sim);
+
+// Start over from an empty port with another seed, reusing the memory of the
+// simulation. Returns -1 with errno EINVAL if the simulation writes a trace,
+// metrics or a write-ahead log (create a new one instead), -1 with ENOMEM if the
+// port could not be rebuilt (destroy the simulation then), 0 otherwise.
+PORT_SIM_API int port_sim_reset(PortSim* sim, uint64_t seed);
+
+// Stop the worker threads and projections, flush and close the outputs and free
+// all memory of the simulation
+PORT_SIM_API void port_sim_destroy(PortSim* sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
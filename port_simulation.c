@@ -1,94 +1,66 @@
+#define _GNU_SOURCE
+
+// Terminal front end of the yacht port simulation: option parsing, headless
+// runs, the ncurses display, the live loop and its control socket. The engine
+// itself is the libportsim library (port_core.c).
+
 #include <ncurses.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
-#include <stdatomic.h>
 #include <math.h>
 #include <string.h>
-
-#define PORT_ROWS 20       // Number of rows in the port
-#define PORT_COLS 25       // Number of columns in the port
-#define SLOT_SIZE 5        // Each slot represents 5 meters
-#define MAX_QUEUE 10       // Max yachts in the waiting queue
-#define MAX_DOCKED 20      // Max yachts in the docked list
-#define QUAY_LENGTH 3      // Amount of columns in quay
-#define MAX_CREWS 4        // 2 cleaning, 2 repair
-
-#define YACHT_MIN_LENGTH 10
-#define YACHT_MAX_LENGTH 50
-
-#define YACHT_MIN_WIDTH 5
-#define YACHT_MAX_WIDTH 30
-
-// Structure for a yacht
-typedef struct {
-    int id;                       // Unique ID
-    int length;                   // Length of the yacht in meters
-    int width;                    // Width of the yacht in meters
-    atomic_int state;             // State: 1=waiting, 2=docked, 3=leaving, 4=docked at fuel station
-    atomic_int oil_level;         // Level of oil in tank in percents
-    atomic_bool need_cleaning;    // Whether the yacht needs cleaning
-    atomic_bool need_repair;      // Whether the yacht needs repair
-    int waiting_time;             // Time spent waiting in seconds
-} Yacht;
-
-// Port slot structure
-typedef struct {
-    int row;                      // Row index of the slot
-    int col;                      // Column index of the slot
-    atomic_int occupied;          // ID of the occupying yacht, -1 if free, -2 if quay, -3 if oil pump
-} PortSlot;
-
-// Structure for a port crew
-typedef struct {
-    int id;                       // Unique ID of the crew
-    int yacht_id;                 // Yacht assigned to the crew, -1 if no yacht assigned
-    int crew_size;                // Number of crew members
-    atomic_int state;             // State: 0=idle, 1=working, 2=waiting for yacht
-    int job_id;                   // ID of the job assigned to the crew, 1 for cleaning, 2 for repairing
-} PortCrew;
-
-// Port and queue data
-PortSlot port[PORT_ROWS][PORT_COLS]; // Port grid
-Yacht queue[MAX_QUEUE];              // Waiting queue
-Yacht docked[MAX_DOCKED];            // List of docked yachts
-PortCrew crews[MAX_CREWS];           // Port crews
-int queue_size = 0;                  // Current size of the queue
-int docked_size = 0;                 // Current size of the docked list
-
-// Mutexes for thread safety
-pthread_mutex_t port_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t docked_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// Statistics structure for the port
-typedef struct {
-    int total_yachts_serviced;   // Total number of yachts serviced
-    long total_waiting_time;     // Total waiting time of all yachts
-    int max_waiting_time;        // Maximum waiting time observed
-    int total_cleanings;         // Total number of cleanings performed
-    int total_repairs;           // Total number of repairs performed
-    int total_refuels;           // Total number of refuels performed
-} PortStats;
-PortStats stats = {0};
+#include <stdio.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <linux/perf_event.h>
+
+#include "port_core.h"
+#include "port_sim.h"
 
 // Function prototypes
 void init_ncurses();
 void cleanup_ncurses();
-void* yacht_thread(void* arg);
-void* display_thread(void* arg);
-void* port_crew_thread(void* arg);
-void add_to_queue(Yacht* yacht);
-void assign_to_port(Yacht* yacht);
-void release_slot(Yacht* yacht);
+void engine_run_headless(long duration_sec);
+void engine_run_live(const char* control_path);
+void display_all();
 void display_port();
 void display_queue();
 void display_docked_list();
 void display_port_crew_list();
 void display_stats();
 
+#define HEADLESS_SLICE_SEC 60 // Simulated seconds between checks for a shutdown signal
+#define CONTROL_CLIENTS 16    // Control connections whose command line is still arriving
+
+// A control connection read by the live loop as its command line arrives, so a
+// client that connects and sends nothing never blocks the loop
+typedef struct {
+    int fd;                   // -1 if the entry is free
+    size_t len;
+    char cmd[128];
+} ControlClient;
+
+int drain_on_quit = 0;        // Let the yachts in port finish when the run is stopped (--drain)
+int signal_fd = -1;           // SIGINT, SIGTERM and SIGHUP, blocked in every thread
+
+// Whether a shutdown signal has arrived
+static int shutdown_requested() {
+    struct signalfd_siginfo info;
+    return signal_fd >= 0 && read(signal_fd, &info, sizeof(info)) == sizeof(info);
+}
+
 // Initialize ncurses
 void init_ncurses() {
     initscr();
@@ -116,315 +88,252 @@ void cleanup_ncurses() {
     endwin();
 }
 
-// Main thread for each yacht
-void* yacht_thread(void* arg) {
-    Yacht* yacht = (Yacht*)arg;
-    sleep(rand() % 3 + 1); // Simulate arrival delay
-
-    pthread_mutex_lock(&queue_mutex);
-    add_to_queue(yacht);
-    pthread_mutex_unlock(&queue_mutex);
-
-    while (atomic_load(&yacht->state) != 3) { // While not leaving
-        assign_to_port(yacht);
-
-        if (atomic_load(&yacht->state) == 2) {
-            int extra_wait = 0;
-
-            // If cleaning or repair is needed, add yacht to crew queue and wait
-            if (yacht->need_cleaning) {
-                int assigned = 0, crew_idx = -1;
-                while (!assigned) {
-                    for (int i = 0; i < MAX_CREWS / 2; i++) {
-                        if (atomic_load(&crews[i].state) == 0) {
-                            crews[i].yacht_id = yacht->id;
-                            atomic_store(&crews[i].state, 1); // working
-                            assigned = 1;
-                            crew_idx = i;
-                            pthread_mutex_lock(&stats_mutex);
-                            stats.total_cleanings++;
-                            pthread_mutex_unlock(&stats_mutex);
-                            break;
-                        }
-                    }
-                    if (!assigned) sleep(1);
-                }
-                // Czekaj aż ekipa skończy
-                while (!(atomic_load(&crews[crew_idx].state) == 0 && crews[crew_idx].yacht_id == -1)) {
-                    sleep(1);
-                }
-                extra_wait += 5; // Add 5 seconds for cleaning
-            }
-            if (yacht->need_repair) {
-                int assigned = 0, crew_idx = -1;
-                while (!assigned) {
-                    for (int i = MAX_CREWS / 2; i < MAX_CREWS; i++) {
-                        if (atomic_load(&crews[i].state) == 0) {
-                            crews[i].yacht_id = yacht->id;
-                            atomic_store(&crews[i].state, 1); // working
-                            assigned = 1;
-                            crew_idx = i;
-                            pthread_mutex_lock(&stats_mutex);
-                            stats.total_repairs++;
-                            pthread_mutex_unlock(&stats_mutex);
-                            break;
-                        }
-                    }
-                    if (!assigned) sleep(1);
-                }
-                // Czekaj aż ekipa skończy
-                while (!(atomic_load(&crews[crew_idx].state) == 0 && crews[crew_idx].yacht_id == -1)) {
-                    sleep(1);
-                }
-                extra_wait += 5; // Add 5 seconds for repair
-            }
-
-            // Docked: Stay for a random duration, then leave
-            sleep(rand() % 20 + 20 + extra_wait); // Stay docked for 20–40 seconds + extra
-            release_slot(yacht);
-            atomic_store(&yacht->state, 3); // Mark as leaving
-        }
-        if (atomic_load(&yacht->state) == 4) {
-            // Docked at fuel station: refuel depending on oil level
-            int oil = atomic_load(&yacht->oil_level);
-            pthread_mutex_lock(&stats_mutex);
-            stats.total_refuels++;
-            pthread_mutex_unlock(&stats_mutex);
-            while (oil < 100) {
-                usleep(300000); // Wait 300 ms
-                oil++;
-                atomic_store(&yacht->oil_level, oil);
-
-                // Update oil_level in docked list for display
-                pthread_mutex_lock(&docked_mutex);
-                for (int i = 0; i < docked_size; i++) {
-                    if (docked[i].id == yacht->id) {
-                        docked[i].oil_level = oil;
-                        break;
-                    }
-                }
-                pthread_mutex_unlock(&docked_mutex);
-            }
-            // When refueled, leave fuel station and try to dock again for services
-            release_slot(yacht);
-            if(yacht->need_cleaning == true || yacht->need_repair == true){
-                atomic_store(&yacht->state, 1); // Set back to waiting (queue)
-                yacht->waiting_time = 0; // Optionally reset waiting time
-                pthread_mutex_lock(&queue_mutex);
-                add_to_queue(yacht);
-                pthread_mutex_unlock(&queue_mutex);
-                continue; // Go back to main loop and try to dock again
-            }
-            else
-
-            atomic_store(&yacht->state, 3); // Mark as leaving
-        }
-
-        sleep(1); // Retry after 1 second if waiting
-        if (atomic_load(&yacht->state) == 1) {
-            yacht->waiting_time++;
-            // Aktualizuj waiting_time w queue[]
-            pthread_mutex_lock(&queue_mutex);
-            for (int i = 0; i < queue_size; i++) {
-                if (queue[i].id == yacht->id) {
-                    queue[i].waiting_time = yacht->waiting_time;
-                    break;
-                }
-            }
-            pthread_mutex_unlock(&queue_mutex);
-        }
+// Run the event-driven engine without a display for 'duration_sec' simulated seconds
+void engine_run_headless(long duration_sec) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    engine_start();
+    uint64_t end_tick = (uint64_t)duration_sec * TICKS_PER_SEC;
+    wal_catch_up(end_tick);
+    int interrupted = 0;
+    while (engine.wheel.now < end_tick && !(interrupted = shutdown_requested())) {
+        uint64_t slice = engine.wheel.now + HEADLESS_SLICE_SEC * TICKS_PER_SEC;
+        engine_advance(slice < end_tick ? slice : end_tick);
     }
-    // Update statistics after yacht leaves
-    pthread_mutex_lock(&stats_mutex);
-    stats.total_yachts_serviced++;
-    stats.total_waiting_time += yacht->waiting_time;
-    if (yacht->waiting_time > stats.max_waiting_time)
-        stats.max_waiting_time = yacht->waiting_time;
-    pthread_mutex_unlock(&stats_mutex);
+    if (interrupted || drain_on_quit)
+        engine_shutdown(drain_on_quit);
+    engine_close_outputs();
 
-    free(yacht); // Free memory after yacht thread ends
-    pthread_exit(NULL);
-}
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
 
-// Port crew thread function
-void* port_crew_thread(void* arg) {
-    PortCrew* crew = (PortCrew*)arg;
-    while (1) {
-        if (atomic_load(&crew->state) == 1) {
-            // Simulate work for 10 seconds
-            sleep(10);
-            atomic_store(&crew->state, 0); // Go back to idle
-            crew->yacht_id = -1;
-        } else {
-            sleep(1);
-        }
-    }
-    pthread_exit(NULL);
+    printf("Simulated %ld s in %.3f s of wall time\n", (long)(engine.wheel.now / TICKS_PER_SEC), wall);
+    engine_print_summary(wall);
 }
 
-// Add a yacht to the waiting queue
-void add_to_queue(Yacht* yacht) {
-    if (queue_size < MAX_QUEUE) {
-        queue[queue_size++] = *yacht;
+// Open a listening UNIX socket for control commands
+static int open_control_socket(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return -1;
     }
+    return fd;
 }
 
-// Check if a yacht can dock at a given position
-int can_dock_here(int r, int c, int slots_length, int slots_width, int required_id) {
-    for (int i = 0; i < slots_length; i++) {
-        for (int j = 0; j < slots_width; j++) {
-            if (r + i >= PORT_ROWS || c + j >= PORT_COLS)
-                return 0;
-            if (atomic_load(&port[r + i][c + j].occupied) != required_id)
-                return 0;
-        }
+// Read what has arrived of a client's command line, returns 1 once it is
+// complete (a newline, a full buffer, end of file or an error)
+static int control_client_read(ControlClient* c) {
+    for (;;) {
+        ssize_t n = read(c->fd, c->cmd + c->len, sizeof(c->cmd) - 1 - c->len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno != EAGAIN;
+        if (n == 0)
+            return 1;
+        c->len += n;
+        if (memchr(c->cmd + c->len - n, '\n', n) || c->len == sizeof(c->cmd) - 1)
+            return 1;
     }
-    return 1;
 }
 
-// Find the best docking spot for a yacht
-void find_best_docking_spot(int slots_length, int slots_width, int* best_r, int* best_c, int* best_quay_distance, int required_id) {
-    *best_r = -1;
-    *best_c = -1;
-    *best_quay_distance = PORT_COLS * SLOT_SIZE;
-
-    for (int r = 0; r <= PORT_ROWS - slots_length; r++) {
-        for (int c = 0; c <= PORT_COLS - slots_width; c++) {
-            if (can_dock_here(r, c, slots_length, slots_width, required_id)) {
-                int min_distance = PORT_COLS * SLOT_SIZE;
-                for (int j = c; j < c + slots_width; j++) {
-                    int left = j, right = j;
-                    int left_dist = PORT_COLS * SLOT_SIZE, right_dist = PORT_COLS * SLOT_SIZE;
-                    while (left >= 0) {
-                        if (atomic_load(&port[r][left].occupied) == -2) {
-                            left_dist = j - left; break;
-                        }
-                        left--;
-                    }
-                    while (right < PORT_COLS) {
-                        if (atomic_load(&port[r][right].occupied) == -2) {
-                            right_dist = right - j; break;
-                        }
-                        right++;
-                    }
-                    int local_min = (left_dist < right_dist) ? left_dist : right_dist;
-                    if (local_min < min_distance)
-                        min_distance = local_min;
-                }
-                if (min_distance < *best_quay_distance) {
-                    *best_quay_distance = min_distance;
-                    *best_r = r;
-                    *best_c = c;
-                }
-            }
-        }
+// Answer one control request: the command line in 'cmd', the reply to 'fd'
+static void serve_control_client(int fd, char* cmd) {
+    cmd[strcspn(cmd, "\r\n")] = '\0';
+
+    char reply[512];
+    if (strcmp(cmd, "stats") == 0) {
+        pthread_mutex_lock(&stats_mutex);
+        snprintf(reply, sizeof(reply),
+            "time=%.1f serviced=%d avg_wait=%.2f max_wait=%d cleanings=%d repairs=%d refuels=%d queue=%d docked=%d\n",
+            (double)engine.wheel.now / TICKS_PER_SEC,
+            stats.total_yachts_serviced,
+            stats.total_yachts_serviced ? (double)stats.total_waiting_time / stats.total_yachts_serviced : 0.0,
+            stats.max_waiting_time, stats.total_cleanings, stats.total_repairs, stats.total_refuels,
+            queue_size, docked_size);
+        pthread_mutex_unlock(&stats_mutex);
+    } else if (strncmp(cmd, "whatif", 6) == 0 && (cmd[6] == ' ' || cmd[6] == '\0')) {
+        if (whatif_start(fd, cmd + 6, reply, sizeof(reply)))
+            return; // The projection replies when it is done
+    } else {
+        snprintf(reply, sizeof(reply), "error: unknown command '%s'\n", cmd);
     }
+    ssize_t unused = write(fd, reply, strlen(reply));
+    (void)unused;
 }
 
-// Assign a yacht to a port slot
-void assign_to_port(Yacht* yacht) {
-    pthread_mutex_lock(&port_mutex);
-
-    int slots_length = ceil((double)yacht->length / SLOT_SIZE);
-    int slots_width  = ceil((double)yacht->width / SLOT_SIZE);
+// Milliseconds elapsed on the monotonic clock since 'start'
+static uint64_t ms_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
 
-    int best_r, best_c, best_quay_distance;
-    int can_dock = 0, docked_on_fuel = 0;
+// Run the engine in wall-clock time with the ncurses display. A single thread
+// sleeps in epoll_wait until the next timer expiry (timerfd), a key press, a
+// control socket request or a shutdown signal; nothing polls while the port is idle.
+void engine_run_live(const char* control_path) {
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int ctl_fd = control_path ? open_control_socket(control_path) : -1;
+    ControlClient clients[CONTROL_CLIENTS];
+    for (int i = 0; i < CONTROL_CLIENTS; i++)
+        clients[i].fd = -1;
+    if (tfd < 0 || epfd < 0 || (control_path && ctl_fd < 0)) {
+        perror("engine_run_live");
+        return;
+    }
 
-    if (yacht->oil_level < 50) {
-        // Only allow docking in slots with occupied == -3 (special low-oil dock)
-        find_best_docking_spot(slots_length, slots_width, &best_r, &best_c, &best_quay_distance, -3);
-        if (best_r != -1 && best_c != -1) {
-            can_dock = 1; docked_on_fuel = 1;
-        }
-    } else {
-        // Try normal docking first
-        find_best_docking_spot(slots_length, slots_width, &best_r, &best_c, &best_quay_distance, -1);
-        if (best_r != -1 && best_c != -1) {
-            can_dock = 1;
-        } else if (yacht->waiting_time >= 15) {
-            // If waiting too long, allow docking at fuel station
-            find_best_docking_spot(slots_length, slots_width, &best_r, &best_c, &best_quay_distance, -3);
-            if (best_r != -1 && best_c != -1) can_dock = 1, docked_on_fuel = 1;
-        }
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = tfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+    ev.data.fd = STDIN_FILENO;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+    if (ctl_fd >= 0) {
+        ev.data.fd = ctl_fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, ctl_fd, &ev);
+    }
+    if (signal_fd >= 0) {
+        ev.data.fd = signal_fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, signal_fd, &ev);
     }
 
-    if (can_dock) {
-        for (int i = 0; i < slots_length; i++)
-            for (int j = 0; j < slots_width; j++)
-                atomic_store(&port[best_r + i][best_c + j].occupied, yacht->id);
+    init_ncurses();
+    timeout(0);
+
+    engine_start();
+    wal_catch_up(UINT64_MAX);
+    // Wall-clock origin of tick 0, so that a resumed run goes on from its tick
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t elapsed_ms = engine.wheel.now * TICK_MS;
+    start.tv_sec -= elapsed_ms / 1000;
+    start.tv_nsec -= (elapsed_ms % 1000) * 1000000;
+    if (start.tv_nsec < 0) {
+        start.tv_sec--;
+        start.tv_nsec += 1000000000;
+    }
 
-        if (docked_on_fuel)
-            atomic_store(&yacht->state, 4); // docked at fuel station
-        else
-            atomic_store(&yacht->state, 2); // docked
-
-        // Remove yacht from the queue
-        pthread_mutex_lock(&queue_mutex);
-        for (int i = 0; i < queue_size; i++) {
-            if (queue[i].id == yacht->id) {
-                for (int j = i; j < queue_size - 1; j++)
-                    queue[j] = queue[j + 1];
-                queue_size--;
-                break;
+    int running = 1;
+    while (running) {
+        // Catch up with the wall clock, then redraw if anything happened
+        uint64_t due = ms_since(&start) / TICK_MS;
+        long fired = engine.wheel.fired;
+        while (engine.wheel.now <= due) {
+            wheel_advance(&engine.wheel);
+            wal_tick();
+        }
+        if (engine.wheel.fired != fired)
+            display_all();
+
+        // Arm the timerfd for the next scheduled event only
+        uint64_t next = wheel_next_expiry(&engine.wheel);
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        if (next != UINT64_MAX) {
+            uint64_t ms = next * TICK_MS;
+            its.it_value.tv_sec = start.tv_sec + ms / 1000;
+            its.it_value.tv_nsec = start.tv_nsec + (ms % 1000) * 1000000;
+            if (its.it_value.tv_nsec >= 1000000000) {
+                its.it_value.tv_sec++;
+                its.it_value.tv_nsec -= 1000000000;
             }
         }
-        pthread_mutex_unlock(&queue_mutex);
-
-        // Add to docked list
-        pthread_mutex_lock(&docked_mutex);
-        if (docked_size < MAX_DOCKED)
-            docked[docked_size++] = *yacht;
-        pthread_mutex_unlock(&docked_mutex);
-    }
-    pthread_mutex_unlock(&port_mutex);
-}
-
-// Release a port slot when a yacht leaves
-void release_slot(Yacht* yacht) {
-    pthread_mutex_lock(&port_mutex);
+        timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+        wal_commit(); // Nothing is logged while the engine sleeps
 
-    int slots_length = ceil((double)yacht->length / SLOT_SIZE);
-    int slots_width = ceil((double)yacht->width / SLOT_SIZE);
-
-    // Scan to find the top-left slot occupied by the yacht
-    for (int r = 0; r <= PORT_ROWS - slots_length; r++) {
-        for (int c = 0; c <= PORT_COLS - slots_width; c++) {
-            int found = 1;
-            for (int i = 0; i < slots_length; i++)
-                for (int j = 0; j < slots_width; j++)
-                    if (atomic_load(&port[r + i][c + j].occupied) != yacht->id) { found = 0; break; }
-            if (found) {
-                // Restore each slot according to the logic from main (oil pump or free)
-                for (int i = 0; i < slots_length; i++)
-                    for (int j = 0; j < slots_width; j++) {
-                        int slot_r = r + i, slot_c = c + j;
-                        int last_quay_col = -1, next_quay = 0, spacing = QUAY_LENGTH;
-                        for (int qc = 0; qc <= slot_c; qc++)
-                            if (qc == next_quay) { last_quay_col = qc; next_quay += spacing; spacing++; }
-                        if (last_quay_col > floor(PORT_COLS / 2))
-                            atomic_store(&port[slot_r][slot_c].occupied, -3); // oil pump
-                        else
-                            atomic_store(&port[slot_r][slot_c].occupied, -1); // free
+        struct epoll_event events[8];
+        int n = epoll_wait(epfd, events, 8, -1);
+        if (n < 0 && errno != EINTR)
+            break;
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == tfd) {
+                uint64_t expirations;
+                ssize_t unused = read(tfd, &expirations, sizeof(expirations));
+                (void)unused;
+            } else if (fd == STDIN_FILENO) {
+                // Allow to exit program by pressing 'q' or 'Q'
+                int ch, keys = 0, pending = 0;
+                while ((ch = getch()) != ERR) {
+                    keys++;
+                    if (ch == 'q' || ch == 'Q')
+                        running = 0;
+                    else if (ch == KEY_RESIZE)
+                        display_all();
+                }
+                // A closed or hung up stdin stays readable: stop watching it
+                // (signals still stop the run)
+                if ((events[i].events & (EPOLLHUP | EPOLLERR)) ||
+                    (keys == 0 && ioctl(STDIN_FILENO, FIONREAD, &pending) == 0 && pending == 0))
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+            } else if (fd == ctl_fd) {
+                // Clients are read when their data arrives; one too many is turned away
+                int client;
+                while ((client = accept4(ctl_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+                    int free_slot = -1;
+                    for (int j = 0; j < CONTROL_CLIENTS && free_slot < 0; j++)
+                        if (clients[j].fd < 0)
+                            free_slot = j;
+                    struct epoll_event cev = { .events = EPOLLIN | EPOLLRDHUP };
+                    cev.data.fd = client;
+                    if (free_slot < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, client, &cev) < 0) {
+                        close(client);
+                        continue;
                     }
-                goto done;
+                    clients[free_slot].fd = client;
+                    clients[free_slot].len = 0;
+                }
+            } else if (fd == signal_fd) {
+                if (shutdown_requested())
+                    running = 0;
+            } else {
+                for (int j = 0; j < CONTROL_CLIENTS; j++) {
+                    ControlClient* c = &clients[j];
+                    if (c->fd != fd || !control_client_read(c))
+                        continue;
+                    // The reply (or a projection's, from its fork) is written blocking
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+                    c->cmd[c->len] = '\0';
+                    serve_control_client(fd, c->cmd);
+                    close(fd);
+                    c->fd = -1;
+                }
             }
         }
+        whatif_reap();
     }
-done:
-    // Remove yacht from docked list safely
-    pthread_mutex_lock(&docked_mutex);
-    for (int i = 0; i < docked_size; i++) {
-        if (docked[i].id == yacht->id) {
-            for (int j = i; j < docked_size - 1; j++)
-                docked[j] = docked[j + 1];
-            docked_size--;
-            break;
-        }
-    }
-    pthread_mutex_unlock(&docked_mutex);
 
-    pthread_mutex_unlock(&port_mutex);
+    // Shut down in order: no more display or projections, then stop arrivals
+    // (and drain the port without the display), then flush the outputs
+    cleanup_ncurses();
+    whatif_abort();
+    engine_shutdown(drain_on_quit);
+    engine_close_outputs();
+    engine_print_shutdown();
+    wal_report();
+    print_output_summary(ms_since(&start) / 1000.0);
+    cpu_report();
+    for (int i = 0; i < CONTROL_CLIENTS; i++)
+        if (clients[i].fd >= 0)
+            close(clients[i].fd);
+    if (ctl_fd >= 0) {
+        close(ctl_fd);
+        unlink(control_path);
+    }
+    close(epfd);
+    close(tfd);
 }
 
 // Display statistics for the port
@@ -442,33 +351,40 @@ void display_stats() {
     pthread_mutex_unlock(&stats_mutex);
 }
 
-// Display thread for updating the port, queue, and docked list
-void* display_thread(void* arg) {
-    while (1) {
-        pthread_mutex_lock(&port_mutex);
-        pthread_mutex_lock(&queue_mutex);
-        pthread_mutex_lock(&docked_mutex);
-        clear();
-        display_stats();
-        display_port();
-        display_queue();
-        display_docked_list();
-        display_port_crew_list();
-        refresh();
-        pthread_mutex_unlock(&docked_mutex);
-        pthread_mutex_unlock(&queue_mutex);
-        pthread_mutex_unlock(&port_mutex);
-        usleep(1000000); // Refresh every 1 second
-    }
-    pthread_exit(NULL);
+// Redraw the port, queue, and docked list
+void display_all() {
+    pthread_mutex_lock(&port_mutex);
+    pthread_mutex_lock(&queue_mutex);
+    pthread_mutex_lock(&docked_mutex);
+    clear();
+    display_stats();
+    display_port();
+    display_queue();
+    display_docked_list();
+    display_port_crew_list();
+    refresh();
+    pthread_mutex_unlock(&docked_mutex);
+    pthread_mutex_unlock(&queue_mutex);
+    pthread_mutex_unlock(&port_mutex);
 }
 
 // Enhanced display of the port with color per yacht ID
 void display_port() {
     mvprintw(3, 10, "Port:");
-    for (int r = 0; r < PORT_ROWS; r++) {
-        for (int c = 0; c < PORT_COLS; c++) {
-            int yacht_id = atomic_load(&port[r][c].occupied);
+    // Larger ports only show their top-left corner. Open water tiles are drawn
+    // without reading their slots.
+    for (int r = 0; r < port_rows && r < PORT_ROWS; r++) {
+        int water = 0;
+        for (int c = 0; c < port_cols && c < PORT_COLS; c++) {
+            if ((c & (TILE_SIZE - 1)) == 0)
+                water = tile_lookup(r >> TILE_BITS, c >> TILE_BITS) < 0;
+            if (water) {
+                attron(COLOR_PAIR(6));
+                mvprintw(5 + r, 10 + c * 6, "  ~~  ");
+                attroff(COLOR_PAIR(6));
+                continue;
+            }
+            int yacht_id = atomic_load(&CELL(r, c).occupied);
 
             if (yacht_id == -2) {
                 // Quay area displayed in strict white on black
@@ -482,6 +398,12 @@ void display_port() {
                 mvprintw(5 + r, 10 + c * 6, "[ OIL]");
                 attroff(COLOR_PAIR(8));
             }
+            else if (yacht_id == -4) {
+                // Kept clear as the way out of a boxed-in yacht
+                attron(COLOR_PAIR(1));
+                mvprintw(5 + r, 10 + c * 6, "[ ~~ ]");
+                attroff(COLOR_PAIR(1));
+            }
             else if (yacht_id != -1) {
                 // Occupied by a yacht
                 int color_pair = (yacht_id % 5) + 2;
@@ -542,13 +464,13 @@ void display_docked_list() {
 void display_port_crew_list() {
     attron(COLOR_PAIR(4));
     mvprintw(27, 110, "Port Crew:");
-    for (int i = 0; i < MAX_CREWS; i++) {
+    for (int i = 0; i < crew_count; i++) {
         char* job = crews[i].job_id == 1 ? "Cleaning" : "Repair";
         char* state;
         if (atomic_load(&crews[i].state) == 0)
             state = "Idle";
         else if (atomic_load(&crews[i].state) == 1)
-            state = "Working";
+            state = crews[i].task == crews[i].job_id ? "Working" : crews[i].task == 1 ? "Cleaning" : "Repairing";
         else
             state = "Waiting";
         mvprintw(29 + i, 110, "CrewID:%d Type:%s State:%s YachtID:%d",
@@ -557,79 +479,301 @@ void display_port_crew_list() {
     attroff(COLOR_PAIR(4));
 }
 
-int main() {
-    srand(time(NULL));
-    init_ncurses();
-    int spacing = QUAY_LENGTH; // initial spacing between quays
-
-    // Initialize port slots with quay, oil pump, or free status
-    for (int r = 0; r < PORT_ROWS; r++) {
-        int next_quay = 0;
-        int spacing = QUAY_LENGTH;
-        int last_quay_col = PORT_COLS;
-
-        for (int c = 0; c < PORT_COLS; c++) {
-            port[r][c].row = r;
-            port[r][c].col = c;
-
-            if (c == next_quay) {
-                atomic_store(&port[r][c].occupied, -2); // quay
-                last_quay_col = c;
-                next_quay += spacing;
-                spacing++;
-            } else {
-                if(last_quay_col > floor(PORT_COLS/2)){
-                    atomic_store(&port[r][c].occupied, -3); // oil pump
-                }
-                else{
-                    atomic_store(&port[r][c].occupied, -1); // free
-                }
+// Open a dTLB load miss counter for this thread, -1 if perf events are unavailable
+static int open_dtlb_counter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Fill the port with random yachts until about 'fill' percent of the berths are taken,
+// returns the percentage actually reached
+static int bench_fill_port(int fill) {
+    long berths = 0, taken = 0;
+    for (long i = 0; i < (long)port_tile_count * TILE_CELLS; i++)
+        berths += atomic_load(&port[i].occupied) == -1 || atomic_load(&port[i].occupied) == -3;
+    int id = 1, misses = 0;
+    while (taken * 100 < berths * fill && misses < 1000) {
+        int l = ceil((double)(sim_rand() % (YACHT_MAX_LENGTH - YACHT_MIN_LENGTH + 1) + YACHT_MIN_LENGTH) / SLOT_SIZE);
+        int w = ceil((double)(sim_rand() % (YACHT_MAX_WIDTH - YACHT_MIN_WIDTH + 1) + YACHT_MIN_WIDTH) / SLOT_SIZE);
+        int r = sim_rand() % (port_rows - l + 1), c = sim_rand() % (port_cols - w + 1);
+        int v = atomic_load(&CELL(r, c).occupied);
+        if ((v != -1 && v != -3) || !can_dock_here(r, c, l, w, v)) {
+            misses++;
+            continue;
+        }
+        misses = 0;
+        set_cells(r, c, l, w, id++);
+        taken += l * w;
+    }
+    // Random placement stalls around two thirds; pack the rest with a row-major sweep
+    for (int r = 0; r < port_rows && taken * 100 < berths * fill; r++)
+        for (int c = 0; c < port_cols && taken * 100 < berths * fill; c++) {
+            int v = atomic_load(&CELL(r, c).occupied);
+            int l = sim_rand() % 3 + 1, w = sim_rand() % 2 + 1;
+            if ((v == -1 || v == -3) && can_dock_here(r, c, l, w, v)) {
+                set_cells(r, c, l, w, id++);
+                taken += l * w;
+            }
+        }
+    return berths ? (int)(taken * 100 / berths) : 0;
+}
+
+// Benchmark docking search latency and dTLB misses with and without huge pages,
+// checking every answer of the selected backend against the reference scan
+static void run_search_bench(int queries, int fill, uint64_t seed) {
+    printf("Docking search benchmark: %dx%d grid (%ld cells), %d queries, backend %s\n",
+        port_rows, port_cols, (long)port_rows * port_cols, queries, allocator->name);
+    int* footprints = (int*)malloc(queries * 2 * sizeof(int));
+    for (int huge = 1; huge >= 0; huge--) {
+        arena_destroy();
+        if (arena_init(arena_port_bytes(), huge) < 0)
+            break;
+        if (init_port() < 0) {
+            fprintf(stderr, "Out of memory building a %dx%d port\n", port_rows, port_cols);
+            break;
+        }
+        engine_init(seed);
+        int filled = bench_fill_port(fill);
+        for (int q = 0; q < queries; q++) {
+            footprints[2 * q] = ceil((double)(sim_rand() % (YACHT_MAX_LENGTH - YACHT_MIN_LENGTH + 1) + YACHT_MIN_LENGTH) / SLOT_SIZE);
+            footprints[2 * q + 1] = ceil((double)(sim_rand() % (YACHT_MAX_WIDTH - YACHT_MIN_WIDTH + 1) + YACHT_MIN_WIDTH) / SLOT_SIZE);
+        }
+
+        int counter = open_dtlb_counter();
+        if (counter >= 0) {
+            ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        int found = 0;
+        for (int q = 0; q < queries; q++) {
+            int r, c, d;
+            find_best_docking_spot(footprints[2 * q], footprints[2 * q + 1], &r, &c, &d, q % 4 ? -1 : -3);
+            found += r != -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        long long misses = -1;
+        if (counter >= 0) {
+            ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+                misses = -1;
+            close(counter);
+        }
+
+        int mismatches = 0;
+        if (allocator->find != scan_find_docking_spot) {
+            for (int q = 0; q < queries; q++) {
+                int r, c, d, ref_r, ref_c, ref_d;
+                find_best_docking_spot(footprints[2 * q], footprints[2 * q + 1], &r, &c, &d, q % 4 ? -1 : -3);
+                scan_find_docking_spot(footprints[2 * q], footprints[2 * q + 1], &ref_r, &ref_c, &ref_d, q % 4 ? -1 : -3);
+                mismatches += r != ref_r || c != ref_c;
             }
         }
+
+        double us = ((t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3) / queries;
+        printf("  %-24s %d%% full | avg search %10.1f us | spots found %d/%d | mismatches vs scan %d | dTLB load misses/search ",
+            arena_backing_name(), filled, us, found, queries, mismatches);
+        if (misses >= 0)
+            printf("%lld\n", misses / queries);
+        else
+            printf("n/a (perf events unavailable)\n");
     }
+    free(footprints);
+}
+
+// Set the CPU list of a role from 'ROLE=LIST', returns 0 for an unknown role
+static int parse_cpus_option(PortSimConfig* config, const char* arg) {
+    const char* eq = strchr(arg, '=');
+    if (!eq)
+        return 0;
+    for (int i = 0; i < PORT_SIM_ROLES; i++)
+        if (strlen(role_names[i]) == (size_t)(eq - arg) && strncmp(arg, role_names[i], eq - arg) == 0) {
+            config->cpus[i] = eq + 1;
+            return 1;
+        }
+    return 0;
+}
 
-    // Initialize cleaning and repair crews BEFORE creating yachts
-    for (int i = 0; i < MAX_CREWS; i++) {
-        crews[i].id = i; // Crew identifier
-        crews[i].yacht_id = -1; // No yacht assigned at start
-        crews[i].crew_size = 3;
-        atomic_store(&crews[i].state, 0); // 0=idle
-        crews[i].job_id = (i < MAX_CREWS/2) ? 1 : 2; // first half cleaning, rest repair
-        pthread_t crew_tid;
-        pthread_create(&crew_tid, NULL, port_crew_thread, &crews[i]);
-        pthread_detach(crew_tid); // Detach since we never join crew threads
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -H, --headless         run the event-driven engine without a display\n"
+        "  -d, --duration=SEC     simulated seconds to run in headless mode (default 3600)\n"
+        "  -s, --seed=N           seed for the random number generator\n"
+        "  -c, --control=PATH     serve one-line commands on a UNIX socket in live mode\n"
+        "  -t, --trace=FILE       write a binary event trace\n"
+        "  -m, --metrics=FILE     write time-series samples as CSV\n"
+        "  -i, --sample-interval=SEC  seconds between metrics samples (default 1)\n"
+        "  -r, --rows=N           rows of the port grid (default %d)\n"
+        "  -C, --cols=N           columns of the port grid (default %d)\n"
+        "  -T, --dockable=PCT     share of the 64x64 tiles of the grid with berths, the rest is open water (default 100)\n"
+        "  -p, --huge-pages=on|off  back simulation state with huge pages (default on)\n"
+        "  -B, --bench-search=N   benchmark N docking searches with and without huge pages\n"
+        "  -F, --bench-fill=PCT   share of berths taken before benchmarking (default 70)\n"
+        "  -j, --speculate=N      precompute docking spots on N worker threads\n"
+        "  -k, --lookahead=K      weigh the K best berths of every docking with rollouts\n"
+        "  -w, --lookahead-threads=N  run rollouts on N worker threads besides the engine\n"
+        "  -b, --lookahead-budget=MS  wall time per look-ahead decision, 0 for none (default 0); runs are not reproducible with a budget\n"
+        "  -W, --wal=DIR          log state changes and take snapshots in DIR, resuming the run saved there\n"
+        "  -S, --snapshot-interval=SEC  simulated seconds between snapshots (default 3600)\n"
+        "  -x, --cross-train=PCT  let idle crews take the other job at PCT percent of their pace, 0 for never (default 0)\n"
+        "  -e, --demand=CLEAN,REPAIR  percent of yachts that need cleaning and repair (default 10,10)\n"
+        "  -D, --drain            when the run ends or is stopped, stop arrivals and let the yachts in port finish\n"
+        "  -a, --cpus=ROLE=LIST   pin the threads of ROLE (engine, speculate, lookahead, output) to CPUs such as 2-5,8\n"
+        "  -A, --allocator=NAME   docking search backend: scan, hist, pyramid, ordered, cached, tiles, anytime (default scan)\n"
+        "  -n, --search-budget=N  slot positions an anytime search may examine, 0 for no limit (default 0)\n"
+        "  -u, --search-budget-us=US  wall time of an anytime search, 0 for no limit (default 0)\n",
+        prog, PORT_ROWS, PORT_COLS);
+}
+
+int main(int argc, char** argv) {
+    PortSimConfig config;
+    port_sim_config_init(&config);
+    int headless = 0;
+    long duration = 3600;
+    const char* control_path = NULL;
+    int bench_queries = 0;
+    int bench_fill = 70;
+
+    static const struct option long_opts[] = {
+        {"headless", no_argument, NULL, 'H'},
+        {"duration", required_argument, NULL, 'd'},
+        {"seed", required_argument, NULL, 's'},
+        {"control", required_argument, NULL, 'c'},
+        {"trace", required_argument, NULL, 't'},
+        {"metrics", required_argument, NULL, 'm'},
+        {"sample-interval", required_argument, NULL, 'i'},
+        {"rows", required_argument, NULL, 'r'},
+        {"cols", required_argument, NULL, 'C'},
+        {"dockable", required_argument, NULL, 'T'},
+        {"huge-pages", required_argument, NULL, 'p'},
+        {"bench-search", required_argument, NULL, 'B'},
+        {"bench-fill", required_argument, NULL, 'F'},
+        {"allocator", required_argument, NULL, 'A'},
+        {"search-budget", required_argument, NULL, 'n'},
+        {"search-budget-us", required_argument, NULL, 'u'},
+        {"speculate", required_argument, NULL, 'j'},
+        {"lookahead", required_argument, NULL, 'k'},
+        {"lookahead-threads", required_argument, NULL, 'w'},
+        {"lookahead-budget", required_argument, NULL, 'b'},
+        {"wal", required_argument, NULL, 'W'},
+        {"snapshot-interval", required_argument, NULL, 'S'},
+        {"cross-train", required_argument, NULL, 'x'},
+        {"demand", required_argument, NULL, 'e'},
+        {"drain", no_argument, NULL, 'D'},
+        {"cpus", required_argument, NULL, 'a'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "Hd:s:c:t:m:i:r:C:p:B:F:A:j:k:w:b:W:S:Da:T:n:u:x:e:", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'H': headless = 1; break;
+        case 'd': duration = atol(optarg); break;
+        case 's': config.seed = strtoull(optarg, NULL, 10); break;
+        case 'c': control_path = optarg; break;
+        case 't': config.trace_path = optarg; break;
+        case 'm': config.metrics_path = optarg; break;
+        case 'i': config.sample_interval = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+        case 'r': config.rows = atoi(optarg); break;
+        case 'C': config.cols = atoi(optarg); break;
+        case 'T': config.dockable = atoi(optarg); break;
+        case 'n': config.search_budget_cells = atol(optarg); break;
+        case 'u': config.search_budget_us = atol(optarg); break;
+        case 'p': config.huge_pages = strcmp(optarg, "off") != 0; break;
+        case 'B': bench_queries = atoi(optarg); break;
+        case 'F': bench_fill = atoi(optarg); break;
+        case 'j': config.speculate = atoi(optarg); break;
+        case 'k': config.lookahead = atoi(optarg); break;
+        case 'w': config.lookahead_threads = atoi(optarg); break;
+        case 'b': config.lookahead_budget_ms = atoi(optarg); break;
+        case 'W': config.wal_dir = optarg; break;
+        case 'S': config.snapshot_interval = atoi(optarg); break;
+        case 'x': config.cross_train = atoi(optarg); break;
+        case 'e':
+            if (sscanf(optarg, "%d,%d", &config.demand[0], &config.demand[1]) != 2) {
+                fprintf(stderr, "Expected CLEAN,REPAIR percentages, got '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'D': drain_on_quit = 1; break;
+        case 'a':
+            if (!parse_cpus_option(&config, optarg)) {
+                fprintf(stderr, "Expected ROLE=CPUS with ROLE one of engine, speculate, lookahead, output, got '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'A':
+            if (!select_allocator(optarg)) {
+                fprintf(stderr, "Unknown allocator '%s'\n", optarg);
+                return 1;
+            }
+            config.allocator = optarg;
+            break;
+        default: usage(argv[0]); return 1;
+        }
     }
 
-    // Create the display thread
-    pthread_t display_tid;
-    pthread_create(&display_tid, NULL, display_thread, NULL);
-
-    // Dynamically create yacht threads
-    int yacht_id = 1;
-    while (1) {
-        Yacht* yacht = (Yacht*)malloc(sizeof(Yacht));
-        yacht->id = yacht_id++;
-        yacht->length = rand() % (YACHT_MAX_LENGTH - YACHT_MIN_LENGTH + 1) + YACHT_MIN_LENGTH;
-        yacht->width = rand() % (YACHT_MAX_WIDTH - YACHT_MIN_WIDTH + 1) + YACHT_MIN_WIDTH;
-        yacht->oil_level = rand() % 99 + 1;
-        yacht->waiting_time = 0;
-
-        atomic_store(&yacht->state, 1);   // Initial state: waiting
-        yacht->need_cleaning = (rand() % 10 == 0); // ~10%
-        yacht->need_repair = (rand() % 10 == 0);   // ~10%
-
-        pthread_t yacht_tid;
-        pthread_create(&yacht_tid, NULL, yacht_thread, yacht);
-        pthread_detach(yacht_tid); // Detach since we never join yacht threads
-
-        // Allow to exit program by pressing 'q' or 'Q'
-        timeout(0);
-        int ch = getch();
-        if (ch == 'q' || ch == 'Q') break;
-
-        usleep(5000000); // 5 seconds between new yachts
+    if (config.rows < YACHT_MAX_LENGTH / SLOT_SIZE || config.cols < YACHT_MAX_WIDTH / SLOT_SIZE + 1) {
+        fprintf(stderr, "Port must be at least %dx%d slots\n", YACHT_MAX_LENGTH / SLOT_SIZE, YACHT_MAX_WIDTH / SLOT_SIZE + 1);
+        return 1;
+    }
+    if (config.dockable < 1 || config.dockable > 100) {
+        fprintf(stderr, "The dockable share must be between 1 and 100 percent\n");
+        return 1;
+    }
+    if (config.cross_train < 0 || config.cross_train > 100) {
+        fprintf(stderr, "The off-skill pace of crews must be between 0 and 100 percent\n");
+        return 1;
+    }
+    if (config.wal_dir && config.search_budget_us > 0) {
+        fprintf(stderr, "--search-budget-us depends on wall time, so a --wal run could not be replayed\n");
+        return 1;
+    }
+    if (config.demand[0] < 0 || config.demand[0] > 100 || config.demand[1] < 0 || config.demand[1] > 100) {
+        fprintf(stderr, "The share of yachts needing a service must be between 0 and 100 percent\n");
+        return 1;
+    }
+    if (bench_queries > 0) {
+        port_rows = config.rows;
+        port_cols = config.cols;
+        port_dockable = config.dockable;
+        search_budget_cells = config.search_budget_cells;
+        search_budget_us = config.search_budget_us;
+        run_search_bench(bench_queries, bench_fill, config.seed);
+        arena_destroy();
+        return 0;
     }
 
-    cleanup_ncurses();
+    // Shutdown signals are blocked before any thread starts and read from a
+    // signalfd by the run loops, so they end the run in order instead of killing it
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    signal(SIGPIPE, SIG_IGN); // A control client that went away is not fatal
+
+    PortSim* sim = port_sim_create(&config);
+    if (!sim) {
+        if (errno == ENOMEM)
+            fprintf(stderr, "Out of memory building a %dx%d port\n", config.rows, config.cols);
+        return 1; // The failing output, log or mapping has been reported
+    }
+    if (headless)
+        engine_run_headless(duration);
+    else
+        engine_run_live(control_path);
+    port_sim_destroy(sim);
+    close(signal_fd);
     return 0;
-}
\ No newline at end of file
+}
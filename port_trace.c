@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+
+// Trace tool: answers questions about the binary event traces written with
+// --trace without reading them whole. The trace and its index (FILE.idx, see
+// TraceIndexHeader) are mapped into memory and only the blocks a query needs
+// are touched, so looking up one yacht of a month-long run reads a few blocks,
+// and comparing two runs reads the one block where they part.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "port_core.h"
+
+#define TRACE_HEADER_SIZE 8      // "YPTRACE1"
+
+// A trace mapped into memory, with its index if one was loaded
+typedef struct {
+    const char* path;
+    const TraceRecord* records;
+    uint64_t count;
+    const TraceIndexHeader* index;
+    const uint64_t* block_ticks;  // Tick of the first record of every block
+    const uint64_t* block_hashes; // Hash of the trace up to the end of every block
+    const TraceIndexYacht* yachts;
+    const uint32_t* postings;     // Block numbers of the yachts
+    void* map;
+    size_t map_len;
+    void* index_map;
+    size_t index_len;
+    long blocks_read;             // Blocks touched by the queries so far
+} Trace;
+
+static const char* record_names[] = {"?", "enqueue", "dock", "release", "crew-start", "crew-done", "depart", "manoeuvre"};
+
+// Map a whole file read-only, NULL on failure
+static void* map_file(const char* path, size_t* len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    void* p = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+            p = NULL;
+        *len = st.st_size;
+    }
+    close(fd);
+    return p;
+}
+
+// Map a trace and, if 'with_index', its index; returns 0 with a message on failure
+static int trace_open(Trace* t, const char* path, int with_index) {
+    memset(t, 0, sizeof(*t));
+    t->path = path;
+    t->map = map_file(path, &t->map_len);
+    if (!t->map || t->map_len < TRACE_HEADER_SIZE || memcmp(t->map, "YPTRACE1", 8) != 0) {
+        fprintf(stderr, "%s: not an event trace\n", path);
+        return 0;
+    }
+    t->records = (const TraceRecord*)((const char*)t->map + TRACE_HEADER_SIZE);
+    t->count = (t->map_len - TRACE_HEADER_SIZE) / sizeof(TraceRecord);
+    if (!with_index)
+        return 1;
+
+    char index_path[4096];
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    t->index_map = map_file(index_path, &t->index_len);
+    const TraceIndexHeader* h = (const TraceIndexHeader*)t->index_map;
+    if (!h || t->index_len < sizeof(*h) || memcmp(h->magic, "YPTIDX02", 8) != 0 ||
+        h->block_records != TRACE_BLOCK_RECORDS || h->records != t->count ||
+        t->index_len != sizeof(*h) + 2 * h->blocks * sizeof(uint64_t) + h->yachts * sizeof(TraceIndexYacht) + h->postings * sizeof(uint32_t)) {
+        fprintf(stderr, "%s: missing or out of date, rebuild it with: port_trace index %s\n", index_path, path);
+        return 0;
+    }
+    t->index = h;
+    t->block_ticks = (const uint64_t*)(h + 1);
+    t->block_hashes = t->block_ticks + h->blocks;
+    t->yachts = (const TraceIndexYacht*)(t->block_hashes + h->blocks);
+    t->postings = (const uint32_t*)(t->yachts + h->yachts);
+    return 1;
+}
+
+static void trace_close(Trace* t) {
+    if (t->map)
+        munmap(t->map, t->map_len);
+    if (t->index_map)
+        munmap(t->index_map, t->index_len);
+}
+
+// Print one record as a line of text
+static void print_record(const TraceRecord* r) {
+    printf("%10.1f s  yacht %-6d %-10s ", (double)r->tick / TICKS_PER_SEC, r->yacht_id,
+        r->type > 0 && r->type <= TR_MANOEUVRE ? record_names[r->type] : record_names[0]);
+    switch (r->type) {
+    case TR_ENQUEUE: printf("%d x %d m\n", r->a, r->b); break;
+    case TR_DOCK: printf("berth %d,%d%s\n", r->a, r->b, r->c == 4 ? " (fuel)" : ""); break;
+    case TR_RELEASE: printf("berth %d,%d\n", r->a, r->b); break;
+    case TR_CREW_START: printf("crew %d%s\n", r->a, r->c ? " (other job)" : ""); break;
+    case TR_CREW_DONE: printf("crew %d\n", r->a); break;
+    case TR_DEPART: printf("waited %d s\n", r->a); break;
+    case TR_MANOEUVRE: printf("%s, %d s under way, %d s lost to other yachts\n", r->a ? "outbound" : "inbound", r->b, r->c); break;
+    default: printf("%d %d %d\n", r->a, r->b, r->c); break;
+    }
+}
+
+// Records of block 'block' of a trace
+static const TraceRecord* trace_block(Trace* t, uint64_t block, uint64_t* count) {
+    uint64_t first = block * TRACE_BLOCK_RECORDS;
+    *count = t->count - first < TRACE_BLOCK_RECORDS ? t->count - first : TRACE_BLOCK_RECORDS;
+    t->blocks_read++;
+    return t->records + first;
+}
+
+// index TRACE: build the index of a trace, e.g. one of a run that crashed
+static int cmd_index(const char* path) {
+    Trace t;
+    if (!trace_open(&t, path, 0))
+        return 1;
+    static TraceIndexer ix;
+    for (uint64_t i = 0; i < t.count; i++)
+        trace_index_add(&ix, &t.records[i]);
+    char index_path[4096];
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    int ok = trace_index_write(&ix, index_path);
+    if (ok)
+        printf("%s: %lu records in %ld blocks, %ld yachts\n", index_path, (unsigned long)ix.records, ix.blocks, ix.yachts);
+    else
+        perror(index_path);
+    trace_index_free(&ix);
+    trace_close(&t);
+    return !ok;
+}
+
+// yacht TRACE ID: every event of one yacht, read from the blocks listed for it
+static int cmd_yacht(const char* path, int id) {
+    Trace t;
+    if (!trace_open(&t, path, 1))
+        return 1;
+    long lo = 0, hi = (long)t.index->yachts;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (t.yachts[mid].yacht_id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    long found = 0;
+    if (lo < (long)t.index->yachts && t.yachts[lo].yacht_id == id) {
+        const TraceIndexYacht* y = &t.yachts[lo];
+        for (uint32_t i = 0; i < y->blocks; i++) {
+            uint64_t n;
+            const TraceRecord* r = trace_block(&t, t.postings[y->first + i], &n);
+            for (uint64_t j = 0; j < n; j++)
+                if (r[j].yacht_id == id) {
+                    print_record(&r[j]);
+                    found++;
+                }
+        }
+    }
+    printf("# %ld records of yacht %d, read %ld of %lu blocks\n", found, id, t.blocks_read, (unsigned long)t.index->blocks);
+    trace_close(&t);
+    return 0;
+}
+
+// window TRACE FROM TO: every event between two simulated times, in seconds
+static int cmd_window(const char* path, double from, double to) {
+    Trace t;
+    if (!trace_open(&t, path, 1))
+        return 1;
+    uint64_t from_tick = from > 0 ? (uint64_t)(from * TICKS_PER_SEC + 0.5) : 0;
+    uint64_t to_tick = to > 0 ? (uint64_t)(to * TICKS_PER_SEC + 0.5) : 0;
+    // Records are in tick order: start in the last block that begins before FROM
+    uint64_t lo = 0, hi = t.index->blocks;
+    while (lo < hi) {
+        uint64_t mid = (lo + hi) / 2;
+        if (t.block_ticks[mid] < from_tick)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    long found = 0;
+    int done = 0;
+    for (uint64_t block = lo > 0 ? lo - 1 : 0; block < t.index->blocks && !done; block++) {
+        uint64_t n;
+        const TraceRecord* r = trace_block(&t, block, &n);
+        for (uint64_t j = 0; j < n && !done; j++) {
+            if (r[j].tick > to_tick)
+                done = 1;
+            else if (r[j].tick >= from_tick) {
+                print_record(&r[j]);
+                found++;
+            }
+        }
+    }
+    printf("# %ld records from %.1f s to %.1f s, read %ld of %lu blocks\n", found, from, to, t.blocks_read, (unsigned long)t.index->blocks);
+    trace_close(&t);
+    return 0;
+}
+
+// Print records [from, to) of a trace, each line starting with 'prefix'
+static void print_records(const Trace* t, uint64_t from, uint64_t to, const char* prefix) {
+    for (uint64_t i = from; i < to && i < t->count; i++) {
+        printf("%s", prefix);
+        print_record(&t->records[i]);
+    }
+}
+
+// diff TRACE1 TRACE2 [CONTEXT]: the first record where two runs differ, with
+// CONTEXT records before and after it. Equal hashes at the end of a block mean
+// equal traces up to there, so a binary search over the hashes finds the block
+// with the difference, and only that block of each trace is compared.
+static int cmd_diff(const char* path1, const char* path2, int context) {
+    Trace t[2];
+    memset(t, 0, sizeof(t));
+    int ok = trace_open(&t[0], path1, 1) && trace_open(&t[1], path2, 1);
+    if (!ok) {
+        trace_close(&t[0]);
+        trace_close(&t[1]);
+        return 2;
+    }
+    uint64_t blocks = t[0].index->blocks < t[1].index->blocks ? t[0].index->blocks : t[1].index->blocks;
+    uint64_t lo = 0, hi = blocks;
+    long compared = 0;
+    while (lo < hi) {
+        uint64_t mid = (lo + hi) / 2;
+        compared++;
+        if (t[0].block_hashes[mid] == t[1].block_hashes[mid])
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    uint64_t count = t[0].count < t[1].count ? t[0].count : t[1].count;
+    uint64_t i = lo * TRACE_BLOCK_RECORDS;
+    if (i < count) {
+        t[0].blocks_read++;
+        t[1].blocks_read++;
+    }
+    while (i < count && memcmp(&t[0].records[i], &t[1].records[i], sizeof(TraceRecord)) == 0)
+        i++;
+
+    int differ = i < count || t[0].count != t[1].count;
+    uint64_t before = i > (uint64_t)context ? i - context : 0;
+    if (!differ)
+        printf("# identical: %lu records", (unsigned long)count);
+    else if (i < count)
+        printf("# first difference at record %lu (%.1f s)", (unsigned long)i,
+            (double)(t[0].records[i].tick < t[1].records[i].tick ? t[0].records[i].tick : t[1].records[i].tick) / TICKS_PER_SEC);
+    else
+        printf("# %s ends after record %lu, %s goes on", t[0].count < t[1].count ? path1 : path2,
+            (unsigned long)count, t[0].count < t[1].count ? path2 : path1);
+    printf(" | %ld hash comparisons, %ld block(s) of each trace read\n", compared, t[0].blocks_read);
+    if (differ) {
+        print_records(&t[0], before, i, "  ");
+        print_records(&t[0], i, i + context + 1, "- ");
+        print_records(&t[1], i, i + context + 1, "+ ");
+    }
+    trace_close(&t[0]);
+    trace_close(&t[1]);
+    return differ;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "Usage: %s COMMAND TRACE [ARGS]\n"
+        "  index TRACE             build TRACE.idx (runs with --trace write it when they end)\n"
+        "  yacht TRACE ID          print every event of yacht ID\n"
+        "  window TRACE FROM TO    print every event from FROM to TO seconds of simulated time\n"
+        "  diff TRACE1 TRACE2 [N]  print the first event where two traces differ, with N events around it (default 5)\n",
+        prog);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && strcmp(argv[1], "index") == 0)
+        return cmd_index(argv[2]);
+    if (argc == 4 && strcmp(argv[1], "yacht") == 0)
+        return cmd_yacht(argv[2], atoi(argv[3]));
+    if (argc == 5 && strcmp(argv[1], "window") == 0)
+        return cmd_window(argv[2], atof(argv[3]), atof(argv[4]));
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "diff") == 0)
+        return cmd_diff(argv[2], argv[3], argc == 5 && atoi(argv[4]) >= 0 ? atoi(argv[4]) : 5);
+    usage(argv[0]);
+    return 1;
+}